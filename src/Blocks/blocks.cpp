@@ -251,17 +251,16 @@ bool Block::move(int aDx, int aDy, int aRot, bool aOpenAtBottom)
 
 // MARK: ===== BlocksView
 
-BlocksView::BlocksView()
+BlocksView::BlocksView(int aNumCols, int aNumRows)
 {
-  setContentSize(10, 20); // Tetris has fixed size of 10x20
+  setContentSize(aNumCols, aNumRows); // Tetris has 10x20, but larger boards get a larger playfield
+  colorCodes.resize(aNumCols*aNumRows, 0);
 }
 
 
 void BlocksView::clear()
 {
-  for (int i=0; i<PAGE_NUMPIXELS; ++i) {
-    colorCodes[i] = 0;
-  }
+  colorCodes.assign(colorCodes.size(), 0);
   makeDirty();
 }
 
@@ -269,42 +268,71 @@ void BlocksView::clear()
 ColorCode BlocksView::colorCodeAt(int aX, int aY)
 {
   if (!isInContentSize(aX, aY)) return 0;
-  return colorCodes[aY*PAGE_NUMCOLS+aX];
+  return colorCodes[aY*contentSizeX+aX];
 }
 
 
 void BlocksView::setColorCodeAt(ColorCode aColorCode, int aX, int aY)
 {
   if (!isInContentSize(aX, aY)) return;
-  colorCodes[aY*PAGE_NUMCOLS+aX] = aColorCode;
+  ColorCode &cc = colorCodes[aY*contentSizeX+aX];
+  if (cc!=aColorCode) {
+    cc = aColorCode;
+    PixelRect r = { .x=aX, .y=aY, .dx=1, .dy=1 };
+    makeContentDirty(r);
+  }
 }
 
 
-PixelColor BlocksView::contentColorAt(int aX, int aY)
+ViewPtr BlocksView::snapshot()
+{
+  BlocksViewPtr s = BlocksViewPtr(new BlocksView(contentSizeX, contentSizeY));
+  s->copyViewState(*this);
+  s->colorCodes = colorCodes;
+  return s;
+}
+
+
+static inline PixelColor colorForCode(ColorCode aColorCode)
 {
-  uint8_t cc = colorCodeAt(aX, aY);
   // map to real color
   PixelColor pix;
-  const ColorDef *cdef = &colorDefs[cc];
+  const ColorDef *cdef = &colorDefs[aColorCode];
   pix.r = cdef->r;
   pix.g = cdef->g;
   pix.b = cdef->b;
   pix.a = 255;
-  if (cc>=16 && cc<32) {
+  if (aColorCode>=16 && aColorCode<32) {
     pix = dimPixel(pix, 188);
   }
   return pix;
 }
 
 
+PixelColor BlocksView::contentColorAt(int aX, int aY)
+{
+  return colorForCode(colorCodeAt(aX, aY));
+}
+
+
+void BlocksView::contentSpan(int aX, int aY, int aDx, int aDy, int aNum, PixelColor *aOut)
+{
+  for (int i=0; i<aNum; i++) {
+    aOut[i] = colorForCode(isInContentSize(aX, aY) ? colorCodes[aY*contentSizeX+aX] : 0);
+    aX += aDx;
+    aY += aDy;
+  }
+}
+
+
 
 
 // MARK: ===== BlocksPage
 
 #define BLOCKS_HELP_ANIMATION_STEP_TIME (333*MilliSecond)
 
-BlocksPage::BlocksPage(PixelPageInfoCB aInfoCallback) :
-  inherited("blocks", aInfoCallback),
+BlocksPage::BlocksPage(PixelPageInfoCB aInfoCallback, int aNumCols, int aNumRows) :
+  inherited("blocks", aInfoCallback, aNumCols, aNumRows),
   defaultMode(0x01),
   gameState(game_ready),
   gameMode(0),
@@ -316,7 +344,7 @@ BlocksPage::BlocksPage(PixelPageInfoCB aInfoCallback) :
   stop();
   loadHighScores();
   // game view
-  playfield = BlocksViewPtr(new BlocksView);
+  playfield = BlocksViewPtr(new BlocksView(getNumCols(), getNumRows()));
   sizeViewToPage(playfield);
   // help view
   infoView = ViewStackPtr(new ViewStack());
@@ -324,12 +352,12 @@ BlocksPage::BlocksPage(PixelPageInfoCB aInfoCallback) :
   infoView->setFullFrameContent();
   ImageViewPtr iv = ImageViewPtr(new ImageView);
   sizeViewToPage(iv);
-  iv->loadPNG(Application::sharedApplication()->resourcePath("images/blocks.png"));
+  iv->loadResourcePNG("images/blocks.png");
   infoView->pushView(iv);
   // additional pixels for two-sided play
   twoSidedView = ImageViewPtr(new ImageView);
   sizeViewToPage(twoSidedView);
-  twoSidedView->loadPNG(Application::sharedApplication()->resourcePath("images/blocks2s.png"));
+  twoSidedView->loadResourcePNG("images/blocks2s.png");
   twoSidedView->hide(); // hidden to start with
   infoView->pushView(twoSidedView);
   // - the animation
@@ -339,26 +367,26 @@ BlocksPage::BlocksPage(PixelPageInfoCB aInfoCallback) :
   // - the steps
   iv = ImageViewPtr(new ImageView);
   sizeViewToPage(iv);
-  iv->loadPNG(Application::sharedApplication()->resourcePath("images/blocks1.png"));
+  iv->loadResourcePNG("images/blocks1.png");
   va->pushStep(iv, BLOCKS_HELP_ANIMATION_STEP_TIME);
   iv = ImageViewPtr(new ImageView);
   sizeViewToPage(iv);
-  iv->loadPNG(Application::sharedApplication()->resourcePath("images/blocks2.png"));
+  iv->loadResourcePNG("images/blocks2.png");
   va->pushStep(iv, BLOCKS_HELP_ANIMATION_STEP_TIME);
   iv = ImageViewPtr(new ImageView);
   sizeViewToPage(iv);
-  iv->loadPNG(Application::sharedApplication()->resourcePath("images/blocks3.png"));
+  iv->loadResourcePNG("images/blocks3.png");
   va->pushStep(iv, BLOCKS_HELP_ANIMATION_STEP_TIME);
   // - push animation on top
   infoView->pushView(va);
   va->startAnimation(true);
   // score text view
-  scoretext = TextViewPtr(new TextView(2, 0, 20, View::down));
+  scoretext = TextViewPtr(new TextView(2, 0, getNumRows(), View::down));
   scoretext->setTextColor({255, 128, 0, 255});
   // play selection
   playSelect = ImageViewPtr(new ImageView);
   sizeViewToPage(playSelect);
-  playSelect->loadPNG(Application::sharedApplication()->resourcePath("images/play.png"));
+  playSelect->loadResourcePNG("images/play.png");
   playSelect->show();
   // play selection on top
   infoView->pushView(playSelect);
@@ -430,15 +458,14 @@ void BlocksPage::makeReady(bool aNewShow)
     // do not show last score
     scoretext->hide();
     // auto-start default game in 15 secs
-    MainLoop::currentMainLoop().executeTicketOnce(
-      stateChangeTicket,
+    stateChangeTicket.executeOnce(
       boost::bind(&BlocksPage::startGame, this, defaultMode),
       (defaultMode & pagemode_startnow) ? 1*Second : 15*Second
     );
   }
   else {
     // quit after a while
-    MainLoop::currentMainLoop().executeTicketOnce(stateChangeTicket,boost::bind(&BlocksPage::postInfo, this, "quit"), 42*Second);
+    stateChangeTicket.executeOnce(boost::bind(&BlocksPage::postInfo, this, "quit"), 42*Second);
   }
   makeDirty();
 }
@@ -453,7 +480,7 @@ bool BlocksPage::enabledSide(int aSide)
 void BlocksPage::startGame(PageMode aMode)
 {
   gameMode = aMode;
-  MainLoop::currentMainLoop().cancelExecutionTicket(stateChangeTicket);
+  stateChangeTicket.cancel();
   stop();
   clear();
   if (music) music->play(Application::sharedApplication()->resourcePath("sounds/tetris.mod"));
@@ -506,7 +533,7 @@ void BlocksPage::gameOver()
   if (sound) sound->play(Application::sharedApplication()->resourcePath("sounds/gameover.wav"));
   gameState = game_over;
   playfield->setAlpha(128); // dim board a lot
-  MainLoop::currentMainLoop().executeTicketOnce(stateChangeTicket,boost::bind(&BlocksPage::makeReady, this, false), 10*Second);
+  stateChangeTicket.executeOnce(boost::bind(&BlocksPage::makeReady, this, false), 10*Second);
   ledState[0] = keycode_none; // LEDs off
   ledState[1] = keycode_none; // LEDs off
   int gamescore = score[0]+score[1];
@@ -550,8 +577,8 @@ void BlocksPage::gameOver()
 
 bool BlocksPage::isWithinPlayfield(int aX, int aY, bool aOpen, bool aOpenAtBottom)
 {
-  if (aX<0 || aX>=PAGE_NUMCOLS) return false; // may not extend sidewards
-  if ((aOpenAtBottom || !aOpen) && aY>=PAGE_NUMROWS) return false; // may not extend above playfield
+  if (aX<0 || aX>=getNumCols()) return false; // may not extend sidewards
+  if ((aOpenAtBottom || !aOpen) && aY>=getNumRows()) return false; // may not extend above playfield
   if ((!aOpenAtBottom || !aOpen) && aY<0) return false; // may not extend below playfield
   return true; // within
 }
@@ -596,7 +623,7 @@ bool BlocksPage::handleKey(int aSide, KeyCodes aNewPressedKeys, KeyCodes aCurren
       playModeAccumulator |= newMode;
       ledState[aSide==1 ? 1 : 0] = keycode_all; // immediate feedback: all 4 keys on
       // but start with a little delay so other player can also join
-      MainLoop::currentMainLoop().executeTicketOnce(stateChangeTicket,boost::bind(&BlocksPage::startAccTimeout, this), 5*Second);
+      stateChangeTicket.executeOnce(boost::bind(&BlocksPage::startAccTimeout, this), 5*Second);
     }
     else if (
       (aNewPressedKeys & keycode_outer) &&
@@ -670,11 +697,11 @@ bool BlocksPage::launchBlock(BlockType aBlockType, int aColumn, int aOrientation
   LOG(LOG_DEBUG, "launchblock: blocktype=%d, orientation=%d, extents: minx=%d, maxx=%d, miny=%d, maxy=%d", aBlockType, aOrientation, minx, maxx, miny, maxy);
   // make sure it is within horizontal bounds
   if (aColumn+minx<0) aColumn = -minx;
-  else if (aColumn+maxx>=PAGE_NUMCOLS) aColumn = PAGE_NUMCOLS-1-maxx;
+  else if (aColumn+maxx>=getNumCols()) aColumn = getNumCols()-1-maxx;
   // position vertically with first pixel just visible
   int row;
   if (!aBottom) {
-    row = PAGE_NUMROWS-1-miny;
+    row = getNumRows()-1-miny;
   }
   else {
     row = -maxy;
@@ -686,7 +713,7 @@ bool BlocksPage::launchBlock(BlockType aBlockType, int aColumn, int aOrientation
     return false;
   }
   else {
-    b->lastStep = MainLoop::now();
+    b->lastStep = BoardClock::now();
     return true;
   }
 }
@@ -696,8 +723,8 @@ bool BlocksPage::launchBlock(BlockType aBlockType, int aColumn, int aOrientation
 bool BlocksPage::launchRandomBlock(bool aBottom)
 {
   BlockType bt = (BlockType)(rand() % numBlockTypes);
-  //  int col = rand() % PAGE_NUMCOLS;
-  int col = 5; // always the same
+  //  int col = rand() % getNumCols();
+  int col = getNumCols()/2; // always the same
   return launchBlock(bt, col, 0, aBottom);
 }
 
@@ -712,8 +739,8 @@ void BlocksPage::removeRow(int aY, bool aBlockFromBottom, int aRemovedRows)
   }
   // move towards falling direction of block that has caused the row to fill
   int dir = aBlockFromBottom ? -1 : 1;
-  for (int y=aY; (aBlockFromBottom ? y>=0 : y<PAGE_NUMROWS); y += dir) {
-    for (int x=0; x<PAGE_NUMCOLS; x++) {
+  for (int y=aY; (aBlockFromBottom ? y>=0 : y<getNumRows()); y += dir) {
+    for (int x=0; x<getNumCols(); x++) {
       playfield->setColorCodeAt(playfield->colorCodeAt(x, y+dir), x, y);
     }
   }
@@ -726,7 +753,6 @@ void BlocksPage::removeRow(int aY, bool aBlockFromBottom, int aRemovedRows)
   aRemovedRows++;
   // continue checking
   rowKillTicket.executeOnce(boost::bind(&BlocksPage::checkRows, this, aBlockFromBottom, aRemovedRows), rowKillDelay);
-  makeDirty();
 }
 
 
@@ -734,10 +760,10 @@ void BlocksPage::checkRows(bool aBlockFromBottom, int aRemovedRows)
 {
   // check from top to bottom relative to falling block
   int dir = aBlockFromBottom ? -1 : 1;
-  for (int y = aBlockFromBottom ? PAGE_NUMROWS-1 : 0; (aBlockFromBottom ? y>=0 : y<PAGE_NUMROWS); y += dir) {
+  for (int y = aBlockFromBottom ? getNumRows()-1 : 0; (aBlockFromBottom ? y>=0 : y<getNumRows()); y += dir) {
     // check each row
     bool hasGap = false;
-    for (int x=0; x<PAGE_NUMCOLS; x++) {
+    for (int x=0; x<getNumCols(); x++) {
       if (playfield->colorCodeAt(x, y)==0) {
         hasGap = true;
         break;
@@ -745,12 +771,11 @@ void BlocksPage::checkRows(bool aBlockFromBottom, int aRemovedRows)
     }
     if (!hasGap) {
       // full row found
-      for (int x=0; x<PAGE_NUMCOLS; x++) {
+      for (int x=0; x<getNumCols(); x++) {
         // light up
         playfield->setColorCodeAt(32, x, y); // row flash
       }
       if (sound) sound->play(Application::sharedApplication()->resourcePath()+string_format("/sounds/%dline.wav", aRemovedRows+1));
-      makeDirty();
       rowKillTicket.executeOnce(boost::bind(&BlocksPage::removeRow, this, y, aBlockFromBottom, aRemovedRows), rowKillDelay);
       return;
     }
@@ -779,7 +804,7 @@ void BlocksPage::checkRows(bool aBlockFromBottom, int aRemovedRows)
 
 bool BlocksPage::step()
 {
-  MLMicroSeconds now = MainLoop::now();
+  MLMicroSeconds now = BoardClock::now();
   if (gameState==game_running) {
     int ab = 0;
     for (int i=0; i<2; i++) {
@@ -790,11 +815,9 @@ bool BlocksPage::step()
             // block could move
             b->lastStep = now;
             if (b->dropping) b->droppedsteps++; // count dropped steps
-            makeDirty();
           }
           else {
             // could not move, means that we've collided with floor or existing pixels
-            makeDirty();
             b->block->dim();
             // count dropping score
             if (b->dropping) {
@@ -819,19 +842,30 @@ bool BlocksPage::step()
     }
     if (ab==0) gameOver();
   }
-  scoretext->step();
-  if (scoretext->isDirty()) makeDirty();
   return inherited::step(); // let baseclass step (view etc.)
 }
 
 
+MLMicroSeconds BlocksPage::nextStepTime()
+{
+  MLMicroSeconds next = inherited::nextStepTime();
+  if (gameState==game_running) {
+    for (int i=0; i<2; i++) {
+      BlockRunner *b = &activeBlocks[i];
+      if (b->block && b->lastStep+b->stepInterval<next) {
+        next = b->lastStep+b->stepInterval;
+      }
+    }
+  }
+  return next;
+}
+
+
 void BlocksPage::moveBlock(int aDx, int aRot, bool aLower)
 {
   BlockRunner *b = &activeBlocks[aLower ? 1 : 0];
   if (b->block) {
-    if (b->block->move(aDx, 0, aRot, aLower)) {
-      makeDirty();
-    }
+    b->block->move(aDx, 0, aRot, aLower);
   }
 }
 
@@ -139,11 +139,14 @@ namespace p44 {
     typedef View inherited;
     friend class Block;
 
-    ColorCode colorCodes[PAGE_NUMPIXELS]; ///< internal representation
+    std::vector<ColorCode> colorCodes; ///< internal representation, row by row
 
   public:
 
-    BlocksView();
+    /// create playfield view
+    /// @param aNumCols number of columns of the playfield
+    /// @param aNumRows number of rows of the playfield
+    BlocksView(int aNumCols, int aNumRows);
 
     /// clear contents of this view
     /// @note base class just resets content size to zero, subclasses might NOT want to do that
@@ -160,6 +163,12 @@ namespace p44 {
     /// @param aY PlayField Y coordinate
     void setColorCodeAt(ColorCode aColorCode, int aX, int aY);
 
+    /// the playfield has no transparent pixels
+    virtual PixelRect getOpaqueRect() P44_OVERRIDE { return alpha==255 ? getFrame() : zeroRect; };
+
+    /// create a frozen copy of the playfield
+    virtual ViewPtr snapshot() P44_OVERRIDE;
+
   protected:
 
     /// get color at X,Y
@@ -167,6 +176,8 @@ namespace p44 {
     /// @param aY PlayField Y coordinate
     virtual PixelColor contentColorAt(int aX, int aY) P44_OVERRIDE;
 
+    /// get a run of content pixel colors directly from the color codes
+    virtual void contentSpan(int aX, int aY, int aDx, int aDy, int aNum, PixelColor *aOut) P44_OVERRIDE;
   };
   typedef boost::intrusive_ptr<BlocksView> BlocksViewPtr;
 
@@ -204,8 +215,8 @@ namespace p44 {
     HighScores highscores;
 
 
-    MLTicket rowKillTicket;
-    MLTicket stateChangeTicket;
+    BoardTicket rowKillTicket;
+    BoardTicket stateChangeTicket;
 
     uint8_t ledState[2];
 
@@ -230,7 +241,7 @@ namespace p44 {
     MLMicroSeconds rowKillDelay;
 
 
-    BlocksPage(PixelPageInfoCB aInfoCallback);
+    BlocksPage(PixelPageInfoCB aInfoCallback, int aNumCols, int aNumRows);
 
     /// pass sound channels
     void setSoundChannels(SoundChannelPtr aSound, SoundChannelPtr aMusic) { sound = aSound; music = aMusic; };
@@ -247,6 +258,10 @@ namespace p44 {
     /// @note this is called on the active page at least once per mainloop cycle
     virtual bool step() P44_OVERRIDE;
 
+    /// get time when step() needs to be called next
+    /// @return time of next block movement, or earlier when the page's view needs to be stepped
+    virtual MLMicroSeconds nextStepTime() P44_OVERRIDE;
+
     /// handle key events
     /// @param aSide which side of the board (0=bottom, 1=top)
     /// @param aNewPressedKeys combined keycodes of keys newly detected pressed in this event.
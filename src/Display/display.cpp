@@ -24,24 +24,36 @@
 
 using namespace p44;
 
+#define DEFAULT_PANORAMA_SPEED 5 // pixels per second
+
 
 // MARK: ===== DisplayPage
 
 
-DisplayPage::DisplayPage(PixelPageInfoCB aInfoCallback) :
-  inherited("display", aInfoCallback),
+DisplayPage::DisplayPage(PixelPageInfoCB aInfoCallback, int aNumCols, int aNumRows) :
+  inherited("display", aInfoCallback, aNumCols, aNumRows),
   lastMessageShow(Never)
 {
   clear();
   // user defined content
-  message = TextViewPtr(new TextView(2, 0, 20, View::down));
+  message = TextViewPtr(new TextView(2, 0, getNumRows(), View::down));
   bgimage = ImageViewPtr(new ImageView());
   sizeViewToPage(bgimage);
+  bgimage->setFitToFrame(true); // uploaded photos are usually much larger than the board
+  animation = AnimatedImageViewPtr(new AnimatedImageView());
+  sizeViewToPage(animation);
+  panorama = PanoramaViewPtr(new PanoramaView());
+  sizeViewToPage(panorama);
   // help screen
   infoView = ImageViewPtr(new ImageView());
-  infoView->loadPNG(Application::sharedApplication()->resourcePath("images/main.png"));
+  sizeViewToPage(infoView);
+  infoView->loadResourcePNG("images/main.png");
   ViewStackPtr stack = ViewStackPtr(new ViewStack());
+  sizeViewToPage(stack);
+  stack->setFullFrameContent();
   stack->pushView(bgimage);
+  stack->pushView(animation);
+  stack->pushView(panorama);
   stack->pushView(message);
   stack->pushView(infoView);
   setView(stack);
@@ -74,7 +86,7 @@ void DisplayPage::hide()
 bool DisplayPage::step()
 {
   if (message) {
-    if (lastMessageShow+autoMessageTimeout<MainLoop::now() && defaultMessage.size()>0) {
+    if (lastMessageShow+autoMessageTimeout<BoardClock::now() && defaultMessage.size()>0) {
       showMessage(defaultMessage);
     }
   }
@@ -82,11 +94,24 @@ bool DisplayPage::step()
 }
 
 
+MLMicroSeconds DisplayPage::nextStepTime()
+{
+  MLMicroSeconds next = inherited::nextStepTime();
+  if (message && defaultMessage.size()>0) {
+    MLMicroSeconds t = lastMessageShow+autoMessageTimeout+1;
+    if (t<next) next = t;
+  }
+  return next;
+}
+
+
 
 void DisplayPage::clear()
 {
   if (message) message->clear();
   if (bgimage) bgimage->clear();
+  if (animation) animation->clear();
+  if (panorama) panorama->clear();
 }
 
 
@@ -98,6 +123,16 @@ bool DisplayPage::handleRequest(JsonObjectPtr aRequest, RequestDoneCB aRequestDo
     if (aRequestDoneCB) aRequestDoneCB(JsonObjectPtr(), ErrorPtr());
     return true;
   }
+  else if (aRequest->get("animation", o)) {
+    ErrorPtr err = loadAnimation(o);
+    if (aRequestDoneCB) aRequestDoneCB(JsonObjectPtr(), err);
+    return true;
+  }
+  else if (aRequest->get("panorama", o)) {
+    ErrorPtr err = loadPanorama(o);
+    if (aRequestDoneCB) aRequestDoneCB(JsonObjectPtr(), err);
+    return true;
+  }
   else if (aRequest->get("textcolor", o)) {
     // webcolor
     string webcolor = o->stringValue();
@@ -123,7 +158,7 @@ bool DisplayPage::handleRequest(JsonObjectPtr aRequest, RequestDoneCB aRequestDo
 void DisplayPage::showMessage(const string aMessage)
 {
   message->setText(aMessage);
-  lastMessageShow = MainLoop::now();
+  lastMessageShow = BoardClock::now();
 }
 
 
@@ -159,3 +194,69 @@ ErrorPtr DisplayPage::loadPNGBackground(const string aPNGFileName)
 {
   return bgimage->loadPNG(aPNGFileName);
 }
+
+
+void DisplayPage::loadPNGBackground(const string aPNGFileName, StatusCB aDoneCB, bool aCache)
+{
+  bgimage->loadPNGInBackground(aPNGFileName, aDoneCB, aCache);
+}
+
+
+ErrorPtr DisplayPage::loadAnimation(JsonObjectPtr aSpec)
+{
+  JsonObjectPtr o;
+  ErrorPtr err;
+  MLMicroSeconds delay = 100*MilliSecond;
+  if (aSpec->get("delay", o)) delay = o->int32Value()*MilliSecond;
+  if (aSpec->get("sheet", o)) {
+    int frameSizeY = getNumRows();
+    JsonObjectPtr h;
+    if (aSpec->get("frameheight", h)) frameSizeY = h->int32Value();
+    err = animation->loadSpriteSheet(o->stringValue(), frameSizeY, delay);
+  }
+  else if (aSpec->get("frames", o)) {
+    std::vector<string> files;
+    for (int i=0; i<o->arrayLength(); i++) {
+      files.push_back(o->arrayGet(i)->stringValue());
+    }
+    err = animation->loadSequence(files, delay);
+  }
+  else {
+    // no animation
+    animation->clear();
+    return ErrorPtr();
+  }
+  if (!Error::isOK(err)) return err;
+  if (aSpec->get("delays", o)) {
+    std::vector<MLMicroSeconds> delays;
+    for (int i=0; i<o->arrayLength(); i++) {
+      delays.push_back(o->arrayGet(i)->int32Value()*MilliSecond);
+    }
+    animation->setFrameDelays(delays);
+  }
+  bool repeat = true;
+  if (aSpec->get("repeat", o)) repeat = o->boolValue();
+  animation->startAnimation(repeat);
+  return ErrorPtr();
+}
+
+
+ErrorPtr DisplayPage::loadPanorama(JsonObjectPtr aSpec)
+{
+  JsonObjectPtr o;
+  if (!aSpec->get("image", o)) {
+    // no panorama
+    panorama->clear();
+    return ErrorPtr();
+  }
+  ErrorPtr err = panorama->loadPNG(o->stringValue());
+  if (!Error::isOK(err)) return err;
+  bool loop = true;
+  if (aSpec->get("loop", o)) loop = o->boolValue();
+  panorama->setLooping(loop);
+  double speed = DEFAULT_PANORAMA_SPEED;
+  if (aSpec->get("speed", o)) speed = o->doubleValue();
+  panorama->setPosition(0);
+  panorama->setVelocity(speed);
+  return ErrorPtr();
+}
@@ -25,6 +25,8 @@
 #include "pixelpage.hpp"
 #include "textview.hpp"
 #include "imageview.hpp"
+#include "animatedimageview.hpp"
+#include "panoramaview.hpp"
 #include "viewstack.hpp"
 
 
@@ -37,6 +39,8 @@ namespace p44 {
 
     TextViewPtr message;
     ImageViewPtr bgimage;
+    AnimatedImageViewPtr animation;
+    PanoramaViewPtr panorama;
     ImageViewPtr infoView;
     string defaultMessage;
     MLMicroSeconds lastMessageShow;
@@ -44,7 +48,7 @@ namespace p44 {
 
   public :
 
-    DisplayPage(PixelPageInfoCB aInfoCallback);
+    DisplayPage(PixelPageInfoCB aInfoCallback, int aNumCols, int aNumRows);
 
     /// start showing this page
     /// @param aMode in what mode to show the page (0x01=bottom, 0x02=top, 0x03=both)
@@ -58,9 +62,33 @@ namespace p44 {
     /// @note this is called on the active page at least once per mainloop cycle
     virtual bool step() P44_OVERRIDE;
 
+    /// get time when step() needs to be called next
+    /// @return time of next automatic return to the default message, or earlier when the page's view needs to be stepped
+    virtual MLMicroSeconds nextStepTime() P44_OVERRIDE;
+
     /// show PNG on DisplayPage
     ErrorPtr loadPNGBackground(const string aPNGFileName);
 
+    /// show PNG on DisplayPage, decoded in background while the current background remains visible
+    /// @param aPNGFileName the PNG file. It must not be removed before aDoneCB is called.
+    /// @param aDoneCB called when the new background is shown, or could not be loaded
+    /// @param aCache if not set, the image is not kept in the image cache (for uploaded temporary files)
+    void loadPNGBackground(const string aPNGFileName, StatusCB aDoneCB, bool aCache = true);
+
+    /// show animation on DisplayPage, on top of the background image
+    /// @param aSpec JSON object with either "sheet" (PNG file with frames stacked vertically) and optionally
+    ///   "frameheight" (default: height of the page), or "frames" (array of PNG files, one per frame).
+    ///   Optional "delay" (milliseconds per frame, default 100), "delays" (array of milliseconds for the individual frames)
+    ///   and "repeat" (default: true). Any other value removes the animation.
+    /// @return ok or error
+    ErrorPtr loadAnimation(JsonObjectPtr aSpec);
+
+    /// scroll a wide image across the DisplayPage, on top of the background image and animation
+    /// @param aSpec JSON object with "image" (PNG file) and optionally "speed" (pixels per second, default 5,
+    ///   negative scrolls the other way) and "loop" (default: true). Any other value removes the panorama.
+    /// @return ok or error
+    ErrorPtr loadPanorama(JsonObjectPtr aSpec);
+
     /// set default message
     void setDefaultMessage(const string aMessage);
 
@@ -27,12 +27,13 @@ using namespace p44;
 // MARK: ===== LifePage
 
 
-LifePage::LifePage(PixelPageInfoCB aInfoCallback) :
-  inherited("life", aInfoCallback),
+LifePage::LifePage(PixelPageInfoCB aInfoCallback, int aNumCols, int aNumRows) :
+  inherited("life", aInfoCallback, aNumCols, aNumRows),
   defaultMode(0x01),
   generationInterval(777*MilliSecond),
   staticcount(0)
 {
+  cells.resize(getNumPixels(), 0);
   stop();
 }
 
@@ -45,7 +46,7 @@ void LifePage::hide()
 
 void LifePage::clear()
 {
-  for (int i=0; i<PAGE_NUMPIXELS; ++i) {
+  for (int i=0; i<getNumPixels(); ++i) {
     cells[i] = 0;
   }
   makeDirty();
@@ -125,22 +126,22 @@ void LifePage::revive()
 int LifePage::cellindex(int aX, int aY, bool aWrap)
 {
   if (aX<0) {
-    if (!aWrap) return PAGE_NUMPIXELS; // out of range
-    aX += PAGE_NUMCOLS;
+    if (!aWrap) return getNumPixels(); // out of range
+    aX += getNumCols();
   }
-  else if (aX>=PAGE_NUMCOLS) {
-    if (!aWrap) return PAGE_NUMPIXELS; // out of range
-    aX -= PAGE_NUMCOLS;
+  else if (aX>=getNumCols()) {
+    if (!aWrap) return getNumPixels(); // out of range
+    aX -= getNumCols();
   }
   if (aY<0) {
-    if (!aWrap) return PAGE_NUMPIXELS; // out of range
-    aY += PAGE_NUMROWS;
+    if (!aWrap) return getNumPixels(); // out of range
+    aY += getNumRows();
   }
-  else if (aY>=PAGE_NUMROWS) {
-    if (!aWrap) return PAGE_NUMPIXELS; // out of range
-    aY -= PAGE_NUMROWS;
+  else if (aY>=getNumRows()) {
+    if (!aWrap) return getNumPixels(); // out of range
+    aY -= getNumRows();
   }
-  return aY*PAGE_NUMCOLS+aX;
+  return aY*getNumCols()+aX;
 }
 
 
@@ -155,7 +156,7 @@ void LifePage::calculateGeneration()
   // - 3 = spawned
   // - 4..n aged
   // first age all living cells by 1, clean those that were killed in last cycle
-  for (int i=0; i<PAGE_NUMPIXELS; ++i) {
+  for (int i=0; i<getNumPixels(); ++i) {
     int age = cells[i];
     if (age==1) {
       cells[i] = 0;
@@ -167,9 +168,9 @@ void LifePage::calculateGeneration()
       cells[i]++; // just age normally
     }
   }
-  // apply rules
-  for (int x=0; x<PAGE_NUMCOLS; ++x) {
-    for (int y=0; y<PAGE_NUMROWS; y++) {
+  // apply rules (row by row, in memory order)
+  for (int y=0; y<getNumRows(); y++) {
+    for (int x=0; x<getNumCols(); ++x) {
       int ci = cellindex(x, y, false);
       // calculate number of neighbours
       int nn = 0;
@@ -178,7 +179,7 @@ void LifePage::calculateGeneration()
           if (dx!=0 || dy!=0) {
             // one of the 8 neighbours
             int nci = cellindex(x+dx, y+dy, true);
-            if (nci<PAGE_NUMPIXELS && (cells[nci]>3 || cells[nci]==1)) {
+            if (nci<getNumPixels() && (cells[nci]>3 || cells[nci]==1)) {
               // is a living neighbour (exclude newborns of this cycle, include those that will die at end of this cycle
               nn++;
             }
@@ -216,8 +217,11 @@ void LifePage::calculateGeneration()
 void LifePage::createRandomCells(int aMinCells, int aMaxCells)
 {
   int numcells = aMinCells + rand() % (aMaxCells-aMinCells+1);
+  // counts are for the original board size, scale for larger boards
+  int scale = getNumPixels()/(DEFAULT_NUMCOLS*DEFAULT_NUMROWS);
+  if (scale>1) numcells *= scale;
   while (numcells-- > 0) {
-    int ci = rand() % PAGE_NUMPIXELS;
+    int ci = rand() % getNumPixels();
     cells[ci] = 2; // created out of void
   }
   makeDirty();
@@ -274,8 +278,8 @@ static const PixPattern patterns[] = {
 void LifePage::placePattern(uint16_t aPatternNo, bool aWrap, int aCenterX, int aCenterY, int aOrientation)
 {
   if (aPatternNo>=NUMPATTERNS) return;
-  if (aCenterX<0) aCenterX = rand() % PAGE_NUMCOLS;
-  if (aCenterY<0) aCenterY = rand() % PAGE_NUMROWS;
+  if (aCenterX<0) aCenterX = rand() % getNumCols();
+  if (aCenterY<0) aCenterY = rand() % getNumRows();
   if (aOrientation<0) aOrientation = rand() % 4;
   for (int i=0; i<patterns[aPatternNo].numpix; i++) {
     int x,y;
@@ -287,13 +291,15 @@ void LifePage::placePattern(uint16_t aPatternNo, bool aWrap, int aCenterX, int a
       case 3: x=aCenterX-px.y; y=aCenterY+px.x; break;
     }
     int ci = cellindex(x, y, aWrap);
-    cells[ci] = 2; // created out of void
+    if (ci<getNumPixels()) cells[ci] = 2; // created out of void
   }
 }
 
 
 
-PixelColor LifePage::colorAt(int aX, int aY)
+/// colorize a cell
+/// @param aAge the cell's age, <2 for dead cells
+static PixelColor cellColor(int aAge)
 {
   PixelColor pix;
   pix.a = 255;
@@ -301,9 +307,7 @@ PixelColor LifePage::colorAt(int aX, int aY)
   pix.g = 0;
   pix.b = 0;
   // simplest colorisation: from yellow (young) to red
-  int ci = cellindex(aX, aY, false);
-  if (ci>=PAGE_NUMPIXELS) return pix; // out of range
-  int age = cells[ci];
+  int age = aAge;
   if (age<2) return pix; // dead
   else if (age==2) {
     // artificially created
@@ -339,6 +343,33 @@ PixelColor LifePage::colorAt(int aX, int aY)
 }
 
 
+PixelColor LifePage::colorAt(int aX, int aY)
+{
+  int ci = cellindex(aX, aY, false);
+  if (ci>=getNumPixels()) return cellColor(0); // out of range
+  return cellColor(cells[ci]);
+}
+
+
+ViewPtr LifePage::snapshot()
+{
+  LifeSnapshotView *s = new LifeSnapshotView;
+  s->setFrame(0, 0, getNumCols(), getNumRows());
+  s->setFullFrameContent();
+  s->cells = cells;
+  return ViewPtr(s);
+}
+
+
+// MARK: ===== LifeSnapshotView
+
+PixelColor LifeSnapshotView::contentColorAt(int aX, int aY)
+{
+  if (!isInContentSize(aX, aY)) return cellColor(0); // out of range
+  return cellColor(cells[aY*contentSizeX+aX]);
+}
+
+
 
 KeyCodes LifePage::keyLedState(int aSide)
 {
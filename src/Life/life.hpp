@@ -28,17 +28,32 @@
 
 namespace p44 {
 
+  /// frozen copy of the cells of a LifePage, for rendering on another thread
+  class LifeSnapshotView : public View
+  {
+    typedef View inherited;
+    friend class LifePage;
+
+    std::vector<uint32_t> cells; ///< copy of the cells, row by row
+
+  protected:
+
+    /// get color of the cell at X,Y
+    virtual PixelColor contentColorAt(int aX, int aY) P44_OVERRIDE;
+  };
+
+
   class LifePage : public PixelPage
   {
     typedef PixelPage inherited;
 
-    uint32_t cells[PAGE_NUMPIXELS]; ///< internal representation
+    std::vector<uint32_t> cells; ///< internal representation, row by row
 
     KeyCodes ledState[2];
 
     PageMode defaultMode;
 
-    MLTicket generationTicket;
+    BoardTicket generationTicket;
 
     int dynamics;
     int population;
@@ -49,7 +64,7 @@ namespace p44 {
 
     MLMicroSeconds generationInterval;
 
-    LifePage(PixelPageInfoCB aInfoCallback);
+    LifePage(PixelPageInfoCB aInfoCallback, int aNumCols, int aNumRows);
 
     /// show
     /// @param aMode in what mode to show the page (0x01=bottom, 0x02=top, 0x03=both)
@@ -81,6 +96,9 @@ namespace p44 {
     /// @param aY PlayField Y coordinate
     virtual PixelColor colorAt(int aX, int aY) P44_OVERRIDE;
 
+    /// create a frozen copy of the cells
+    virtual ViewPtr snapshot() P44_OVERRIDE;
+
   protected:
 
     void stop();
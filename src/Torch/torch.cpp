@@ -228,8 +228,8 @@ static const glyph_t fontGlyphs[numGlyphs] = {
 // MARK: ===== TorchPage
 
 
-TorchPage::TorchPage(PixelPageInfoCB aInfoCallback) :
-  inherited("torch", aInfoCallback)
+TorchPage::TorchPage(PixelPageInfoCB aInfoCallback, int aNumCols, int aNumRows) :
+  inherited("torch", aInfoCallback, aNumCols, aNumRows)
 {
 }
 
@@ -35,7 +35,7 @@ namespace p44 {
 
   public :
 
-    TorchPage(PixelPageInfoCB aInfoCallback);
+    TorchPage(PixelPageInfoCB aInfoCallback, int aNumCols, int aNumRows);
 
     /// start showing this page
     /// @param aMode in what mode to show the page (0x01=bottom, 0x02=top, 0x03=both)
@@ -0,0 +1,322 @@
+//
+//  Copyright (c) 2017 plan44.ch / Lukas Zeller, Zurich, Switzerland
+//
+//  Author: Lukas Zeller <luz@plan44.ch>
+//
+//  This file is part of pixelboardd.
+//
+//  pixelboardd is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  pixelboardd is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with pixelboardd. If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#include "animatedimageview.hpp"
+
+using namespace p44;
+
+#define ANIMATION_RING_SIZE 2 // the frame shown, and the next one decoded ahead
+
+
+// MARK: ===== AnimatedImageView
+
+
+AnimatedImageView::AnimatedImageView() :
+  numFrames(0),
+  frameSizeY(0),
+  frameDelay(100*MilliSecond),
+  shownPos(-1),
+  decodedPos(-1),
+  nextFrameTime(Infinite),
+  repeating(false)
+{
+  ring.resize(ANIMATION_RING_SIZE);
+}
+
+
+AnimatedImageView::~AnimatedImageView()
+{
+}
+
+
+void AnimatedImageView::clear()
+{
+  stopAnimation();
+  sheetReader.close();
+  sheetFileName.clear();
+  frameFiles.clear();
+  frameDelays.clear();
+  numFrames = 0;
+  image = DecodedImagePtr();
+  ring.assign(ANIMATION_RING_SIZE, DecodedImagePtr());
+  shownPos = -1;
+  decodedPos = -1;
+  inherited::clear();
+}
+
+
+ErrorPtr AnimatedImageView::loadSpriteSheet(const string aPNGFileName, int aFrameSizeY, MLMicroSeconds aFrameDelay)
+{
+  clear();
+  if (aFrameSizeY<=0) {
+    return TextError::err("invalid frame height %d", aFrameSizeY);
+  }
+  ErrorPtr err = sheetReader.open(aPNGFileName);
+  if (!Error::isOK(err)) return err;
+  numFrames = sheetReader.getSizeY()/aFrameSizeY;
+  if (numFrames<1) {
+    sheetReader.close();
+    return TextError::err("sprite sheet %s is smaller than one frame", aPNGFileName.c_str());
+  }
+  LOG(LOG_INFO, "Animation %s: %d frames of %d*%d pixels", aPNGFileName.c_str(), numFrames, sheetReader.getSizeX(), aFrameSizeY);
+  sheetFileName = aPNGFileName;
+  frameSizeY = aFrameSizeY;
+  frameDelay = aFrameDelay;
+  return rewind();
+}
+
+
+ErrorPtr AnimatedImageView::loadSequence(const std::vector<string> &aPNGFileNames, MLMicroSeconds aFrameDelay)
+{
+  clear();
+  if (aPNGFileNames.empty()) {
+    return TextError::err("animation has no frames");
+  }
+  frameFiles = aPNGFileNames;
+  numFrames = (int)frameFiles.size();
+  frameDelay = aFrameDelay;
+  return rewind();
+}
+
+
+MLMicroSeconds AnimatedImageView::delayOf(int aFrame)
+{
+  if (frameDelays.empty()) return frameDelay;
+  return frameDelays[aFrame%frameDelays.size()];
+}
+
+
+ErrorPtr AnimatedImageView::rewind()
+{
+  shownPos = -1;
+  decodedPos = -1;
+  ErrorPtr err = decodeAhead();
+  if (decodedPos>=0) {
+    showPosition(0);
+  }
+  return err;
+}
+
+
+ErrorPtr AnimatedImageView::decodeAhead()
+{
+  // fill the ring, but never overwrite the frame shown
+  long last = max(shownPos, 0L)+(long)ring.size()-1;
+  if (!repeating && last>=numFrames) last = numFrames-1;
+  while (decodedPos<last) {
+    long pos = decodedPos+1;
+    DecodedImagePtr &slot = ring[pos%ring.size()];
+    if (!slot) slot = DecodedImagePtr(new DecodedImage);
+    ErrorPtr err = decodeFrame((int)(pos%numFrames), slot);
+    if (!Error::isOK(err)) return err;
+    decodedPos = pos;
+  }
+  return ErrorPtr();
+}
+
+
+ErrorPtr AnimatedImageView::decodeFrame(int aFrame, DecodedImagePtr aImage)
+{
+  if (!frameFiles.empty()) {
+    // separate file per frame, not cached, as the next frame will replace it anyway
+    return aImage->loadPNG(frameFiles[aFrame]);
+  }
+  // frame from sprite sheet
+  ErrorPtr err;
+  int row = aFrame*frameSizeY;
+  if (!sheetReader.isOpen() || sheetReader.getNextRow()>row) {
+    // start decoding from the top again
+    err = sheetReader.open(sheetFileName);
+    if (!Error::isOK(err)) return err;
+  }
+  // skip frames in between, if any
+  err = sheetReader.readRows(row-sheetReader.getNextRow(), NULL, 0);
+  if (!Error::isOK(err)) return err;
+  int sx = sheetReader.getSizeX();
+  aImage->sizeX = sx;
+  aImage->sizeY = frameSizeY;
+  aImage->pixels.resize(sx*frameSizeY);
+  aImage->pixelData = &aImage->pixels[0];
+  // rows come top down, content coordinates are bottom up
+  err = sheetReader.readRows(frameSizeY, &aImage->pixels[(frameSizeY-1)*sx], -sx);
+  if (!Error::isOK(err)) return err;
+  aImage->updateAlphaInfo();
+  if (!repeating && aFrame==numFrames-1) {
+    // no more frames needed for now
+    sheetReader.close();
+  }
+  return ErrorPtr();
+}
+
+
+void AnimatedImageView::showPosition(long aPos)
+{
+  shownPos = aPos;
+  image = ring[aPos%ring.size()];
+  if (image->getSizeX()!=contentSizeX || image->getSizeY()!=contentSizeY) {
+    setContentSize(image->getSizeX(), image->getSizeY());
+  }
+  else {
+    makeDirty();
+  }
+}
+
+
+void AnimatedImageView::startAnimation(bool aRepeat, SimpleCB aCompletedCB)
+{
+  repeating = aRepeat;
+  completedCB = aCompletedCB;
+  if (numFrames==0) return;
+  ErrorPtr err;
+  if (shownPos!=0) {
+    err = rewind();
+  }
+  else {
+    err = decodeAhead(); // repeating might need more frames now
+  }
+  if (!Error::isOK(err)) {
+    LOG(LOG_ERR, "Animation cannot run: %s", err->description().c_str());
+  }
+  if (decodedPos<0) return;
+  nextFrameTime = BoardClock::now()+delayOf(0);
+  requestStep();
+}
+
+
+void AnimatedImageView::stopAnimation()
+{
+  nextFrameTime = Infinite;
+}
+
+
+void AnimatedImageView::nextFrame()
+{
+  long pos = shownPos+1;
+  if (!repeating && pos>=numFrames) {
+    // last frame has been shown for its time
+    stopAnimation();
+    if (completedCB) {
+      SimpleCB cb = completedCB;
+      completedCB = NULL;
+      cb();
+    }
+    return;
+  }
+  if (decodedPos<pos) {
+    // frame could not be decoded
+    stopAnimation();
+    return;
+  }
+  showPosition(pos);
+  // next deadline is relative to the previous one, so frame timing does not drift
+  MLMicroSeconds now = BoardClock::now();
+  nextFrameTime += delayOf((int)(pos%numFrames));
+  if (nextFrameTime<now) nextFrameTime = now; // late, but do not rush frames to catch up
+  // decode next frame now, so it is ready when due
+  ErrorPtr err = decodeAhead();
+  if (!Error::isOK(err)) {
+    LOG(LOG_ERR, "Animation stopped: %s", err->description().c_str());
+  }
+  if (repeating && pos%numFrames==0 && completedCB) {
+    // one run done, starting over
+    completedCB();
+  }
+}
+
+
+bool AnimatedImageView::step()
+{
+  bool complete = inherited::step();
+  if (nextFrameTime!=Infinite && BoardClock::now()>=nextFrameTime) {
+    nextFrame();
+  }
+  return complete;
+}
+
+
+MLMicroSeconds AnimatedImageView::nextStepTime()
+{
+  MLMicroSeconds next = inherited::nextStepTime();
+  if (nextFrameTime<next) next = nextFrameTime;
+  return next;
+}
+
+
+bool AnimatedImageView::isAnimating()
+{
+  return inherited::isAnimating() || nextFrameTime!=Infinite;
+}
+
+
+ViewPtr AnimatedImageView::snapshot()
+{
+  AnimatedImageViewPtr s = AnimatedImageViewPtr(new AnimatedImageView);
+  s->copyViewState(*this);
+  if (image) s->image = image->copy();
+  s->nextFrameTime = nextFrameTime; // for isAnimating()
+  return s;
+}
+
+
+PixelRect AnimatedImageView::getOpaqueRect()
+{
+  if (alpha==255 && image) {
+    if (image->isBinaryAlpha() && backgroundColor.a==255) {
+      // transparent pixels show the opaque background
+      return getFrame();
+    }
+    if (image->isOpaque()) {
+      // frame area is opaque
+      PixelRect r = { .x=0, .y=0, .dx=contentSizeX, .dy=contentSizeY };
+      r = contentToFrameRect(r);
+      rectIntersect(r, getFrame());
+      return r;
+    }
+  }
+  return zeroRect;
+}
+
+
+PixelColor AnimatedImageView::contentColorAt(int aX, int aY)
+{
+  if (!image || aX<0 || aX>=contentSizeX || aY<0 || aY>=contentSizeY) {
+    return inherited::contentColorAt(aX, aY);
+  }
+  else {
+    return image->pixelAt(aX, aY);
+  }
+}
+
+
+void AnimatedImageView::contentSpan(int aX, int aY, int aDx, int aDy, int aNum, PixelColor *aOut)
+{
+  for (int i=0; i<aNum; i++) {
+    if (!image || aX<0 || aX>=contentSizeX || aY<0 || aY>=contentSizeY) {
+      aOut[i] = backgroundColor;
+    }
+    else {
+      aOut[i] = image->pixelAt(aX, aY);
+    }
+    aX += aDx;
+    aY += aDy;
+  }
+}
@@ -0,0 +1,140 @@
+//
+//  Copyright (c) 2017 plan44.ch / Lukas Zeller, Zurich, Switzerland
+//
+//  Author: Lukas Zeller <luz@plan44.ch>
+//
+//  This file is part of pixelboardd.
+//
+//  pixelboardd is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  pixelboardd is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with pixelboardd. If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#ifndef __pixelboardd_animatedimageview_hpp__
+#define __pixelboardd_animatedimageview_hpp__
+
+#include "p44utils_common.hpp"
+
+#include "view.hpp"
+#include "imagecache.hpp"
+
+namespace p44 {
+
+  /// Image view showing an animation. Frames are decoded only shortly before they are shown, into a small
+  /// ring of frame buffers, so even long animations run in constant memory.
+  class AnimatedImageView : public View
+  {
+    typedef View inherited;
+
+    PNGRowReader sheetReader; ///< streaming decoder for sprite sheets
+    string sheetFileName; ///< sprite sheet file, empty if frames are separate files
+    std::vector<string> frameFiles; ///< one PNG file per frame, empty for sprite sheets
+    int numFrames; ///< number of frames in the animation
+    int frameSizeY; ///< height of a sprite sheet frame
+    MLMicroSeconds frameDelay; ///< default show time of a frame
+    std::vector<MLMicroSeconds> frameDelays; ///< per frame show times, repeated cyclically if shorter than the animation
+
+    std::vector<DecodedImagePtr> ring; ///< decoded frames, playback position N is in slot N modulo ring size
+    long shownPos; ///< playback position shown (counting on across repetitions), -1 if none
+    long decodedPos; ///< last playback position decoded into the ring, -1 if none
+    DecodedImagePtr image; ///< the frame shown
+    MLMicroSeconds nextFrameTime; ///< when the next frame is due, Infinite if not running
+    bool repeating; ///< set if animation is repeating
+    SimpleCB completedCB; ///< called when one animation run is done
+
+  public :
+
+    AnimatedImageView();
+
+    virtual ~AnimatedImageView();
+
+    /// clear animation
+    virtual void clear() P44_OVERRIDE;
+
+    /// load animation from a sprite sheet
+    /// @param aPNGFileName PNG file with the frames stacked vertically, first frame at the top.
+    ///   It must not be interlaced, because it is decoded row by row while the animation runs.
+    /// @param aFrameSizeY height of one frame (width is that of the sprite sheet)
+    /// @param aFrameDelay show time of every frame
+    /// @return ok or error
+    /// @note the first frame is shown, call startAnimation() to run the animation
+    ErrorPtr loadSpriteSheet(const string aPNGFileName, int aFrameSizeY, MLMicroSeconds aFrameDelay);
+
+    /// load animation from a sequence of PNG files
+    /// @param aPNGFileNames the frames. The files must remain available while the animation runs.
+    /// @param aFrameDelay show time of every frame
+    /// @return ok or error
+    /// @note the first frame is shown, call startAnimation() to run the animation
+    ErrorPtr loadSequence(const std::vector<string> &aPNGFileNames, MLMicroSeconds aFrameDelay);
+
+    /// set individual show times of frames
+    /// @param aFrameDelays show time of every frame. If the animation has more frames, the delays are used cyclically.
+    ///   An empty list means all frames use the delay passed when loading.
+    void setFrameDelays(const std::vector<MLMicroSeconds> &aFrameDelays) { frameDelays = aFrameDelays; };
+
+    /// @return number of frames in the animation
+    int getNumFrames() { return numFrames; };
+
+    /// start animating from the first frame
+    /// @param aRepeat if set, animation will repeat
+    /// @param aCompletedCB called when animation sequence ends (if repeating, it is called multiple times)
+    void startAnimation(bool aRepeat, SimpleCB aCompletedCB = NULL);
+
+    /// stop animation, current frame remains visible
+    /// @note: completed callback will not be called
+    void stopAnimation();
+
+    /// calculate changes on the display, return true if any
+    /// @return true if complete, false if step() would like to be called immediately again
+    virtual bool step() P44_OVERRIDE;
+
+    /// get time when step() needs to be called next
+    /// @return time when the next frame is due, or earlier if the view is fading
+    virtual MLMicroSeconds nextStepTime() P44_OVERRIDE;
+
+    /// return if view is currently animating
+    virtual bool isAnimating() P44_OVERRIDE;
+
+    /// get the area where the current frame is known to be fully opaque
+    virtual PixelRect getOpaqueRect() P44_OVERRIDE;
+
+    /// create a frozen copy of this view showing the current frame
+    /// @note the frame is copied, because its buffer is decoded into again when the ring wraps around
+    virtual ViewPtr snapshot() P44_OVERRIDE;
+
+  protected:
+
+    /// get content color at X,Y
+    virtual PixelColor contentColorAt(int aX, int aY) P44_OVERRIDE;
+
+    /// get a run of content pixel colors directly from the current frame
+    virtual void contentSpan(int aX, int aY, int aDx, int aDy, int aNum, PixelColor *aOut) P44_OVERRIDE;
+
+  private:
+
+    MLMicroSeconds delayOf(int aFrame);
+    ErrorPtr rewind();
+    ErrorPtr decodeAhead();
+    ErrorPtr decodeFrame(int aFrame, DecodedImagePtr aImage);
+    void showPosition(long aPos);
+    void nextFrame();
+
+  };
+  typedef boost::intrusive_ptr<AnimatedImageView> AnimatedImageViewPtr;
+
+
+} // namespace p44
+
+
+
+#endif /* __pixelboardd_animatedimageview_hpp__ */
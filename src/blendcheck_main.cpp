@@ -0,0 +1,104 @@
+//
+//  Copyright (c) 2017 plan44.ch / Lukas Zeller, Zurich, Switzerland
+//
+//  Author: Lukas Zeller <luz@plan44.ch>
+//
+//  This file is part of pixelboardd.
+//
+//  pixelboardd is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  pixelboardd is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with pixelboardd. If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+// Checks the vectorized span blending kernel against the scalar reference, bit for bit.
+// Build and run with 'make check'. Exits with a non-zero status on any mismatch.
+
+#include "view.hpp"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+using namespace p44;
+
+#define MAX_SPAN 67 // covers several full vector blocks plus every possible remainder
+#define MAX_OFFSET 7 // unaligned starts
+#define ROUNDS 2000
+
+
+static uint8_t randomAlpha()
+{
+  switch (rand()%4) {
+    case 0: return 0;
+    case 1: return 255;
+    default: return rand()&0xFF;
+  }
+}
+
+
+static PixelColor randomPixel(bool aPremultiplied)
+{
+  PixelColor p;
+  p.a = randomAlpha();
+  p.r = rand()&0xFF;
+  p.g = rand()&0xFF;
+  p.b = rand()&0xFF;
+  if (aPremultiplied) {
+    p.r = dimVal(p.r, p.a);
+    p.g = dimVal(p.g, p.a);
+    p.b = dimVal(p.b, p.a);
+  }
+  return p;
+}
+
+
+int main(int argc, char **argv)
+{
+  unsigned int seed = argc>1 ? (unsigned int)atoi(argv[1]) : 42;
+  srand(seed);
+  PixelColor layer[MAX_OFFSET+MAX_SPAN];
+  PixelColor vec[MAX_OFFSET+MAX_SPAN];
+  PixelColor ref[MAX_OFFSET+MAX_SPAN];
+  long spans = 0;
+  long mismatches = 0;
+  for (int round=0; round<ROUNDS; round++) {
+    // premultiplied layers as in real compositing, but also arbitrary bytes
+    bool premultiplied = round%2==0;
+    for (int n=1; n<=MAX_SPAN; n++) {
+      int accuOffset = rand()%(MAX_OFFSET+1);
+      int layerOffset = rand()%(MAX_OFFSET+1);
+      for (int i=0; i<MAX_OFFSET+MAX_SPAN; i++) {
+        layer[i] = randomPixel(premultiplied);
+        vec[i] = randomPixel(premultiplied);
+        ref[i] = vec[i];
+      }
+      blendSpanUnder(vec+accuOffset, layer+layerOffset, n);
+      blendSpanUnderScalar(ref+accuOffset, layer+layerOffset, n);
+      spans++;
+      // compare entire buffers, pixels outside the span must not be touched either
+      for (int i=0; i<MAX_OFFSET+MAX_SPAN; i++) {
+        if (vec[i].r!=ref[i].r || vec[i].g!=ref[i].g || vec[i].b!=ref[i].b || vec[i].a!=ref[i].a) {
+          if (mismatches<10) {
+            printf(
+              "mismatch: span length %d, offsets %d/%d, pixel %d: %02X%02X%02X%02X, expected %02X%02X%02X%02X\n",
+              n, accuOffset, layerOffset, i,
+              vec[i].r, vec[i].g, vec[i].b, vec[i].a, ref[i].r, ref[i].g, ref[i].b, ref[i].a
+            );
+          }
+          mismatches++;
+        }
+      }
+    }
+  }
+  printf("blendSpanUnder: %ld spans checked (seed %u), %ld mismatching pixels\n", spans, seed, mismatches);
+  return mismatches==0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
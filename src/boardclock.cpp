@@ -0,0 +1,144 @@
+//
+//  Copyright (c) 2017 plan44.ch / Lukas Zeller, Zurich, Switzerland
+//
+//  Author: Lukas Zeller <luz@plan44.ch>
+//
+//  This file is part of pixelboardd.
+//
+//  pixelboardd is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  pixelboardd is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with pixelboardd. If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#include "boardclock.hpp"
+
+using namespace p44;
+
+
+// MARK: ===== BoardClock
+
+BoardClock::BoardClock() :
+  virtualTime(false),
+  virtualNow(Never),
+  timerSerial(0)
+{
+}
+
+
+BoardClock &BoardClock::sharedClock()
+{
+  static BoardClock clock;
+  return clock;
+}
+
+
+MLMicroSeconds BoardClock::now()
+{
+  BoardClock &c = sharedClock();
+  return c.virtualTime ? c.virtualNow : MainLoop::now();
+}
+
+
+void BoardClock::startVirtualTime(MLMicroSeconds aStartTime)
+{
+  virtualTime = true;
+  virtualNow = aStartTime;
+}
+
+
+MLMicroSeconds BoardClock::nextTimerTime()
+{
+  if (timers.empty()) return Infinite;
+  return timers.begin()->first.first;
+}
+
+
+int BoardClock::advanceTo(MLMicroSeconds aTime)
+{
+  int n = 0;
+  while (!timers.empty() && timers.begin()->first.first<=aTime) {
+    VirtualTimers::iterator pos = timers.begin();
+    BoardTicket *t = pos->second;
+    if (pos->first.first>virtualNow) virtualNow = pos->first.first;
+    timers.erase(pos);
+    // ticket is free again before the callback runs, so the callback can reschedule it
+    t->virtualScheduled = false;
+    SimpleCB cb = t->callback;
+    t->callback = NULL;
+    cb();
+    n++;
+  }
+  if (aTime>virtualNow) virtualNow = aTime;
+  return n;
+}
+
+
+BoardClock::TimerKey BoardClock::schedule(BoardTicket *aTicket, MLMicroSeconds aWhen)
+{
+  TimerKey key(aWhen, timerSerial++);
+  timers[key] = aTicket;
+  return key;
+}
+
+
+void BoardClock::unschedule(TimerKey aKey)
+{
+  timers.erase(aKey);
+}
+
+
+// MARK: ===== BoardTicket
+
+BoardTicket::BoardTicket() :
+  virtualScheduled(false)
+{
+}
+
+
+BoardTicket::~BoardTicket()
+{
+  cancel();
+}
+
+
+void BoardTicket::executeOnce(SimpleCB aCallback, MLMicroSeconds aDelay)
+{
+  executeOnceAt(aCallback, BoardClock::now()+aDelay);
+}
+
+
+void BoardTicket::executeOnceAt(SimpleCB aCallback, MLMicroSeconds aTime)
+{
+  cancel();
+  BoardClock &c = BoardClock::sharedClock();
+  if (c.virtualTime) {
+    callback = aCallback;
+    virtualKey = c.schedule(this, aTime);
+    virtualScheduled = true;
+  }
+  else {
+    ticket.executeOnceAt(boost::bind(aCallback), aTime);
+  }
+}
+
+
+bool BoardTicket::cancel()
+{
+  if (virtualScheduled) {
+    BoardClock::sharedClock().unschedule(virtualKey);
+    virtualScheduled = false;
+    callback = NULL;
+    return true;
+  }
+  return ticket.cancel();
+}
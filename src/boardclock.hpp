@@ -0,0 +1,122 @@
+//
+//  Copyright (c) 2017 plan44.ch / Lukas Zeller, Zurich, Switzerland
+//
+//  Author: Lukas Zeller <luz@plan44.ch>
+//
+//  This file is part of pixelboardd.
+//
+//  pixelboardd is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  pixelboardd is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with pixelboardd. If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#ifndef __pixelboardd_boardclock_hpp__
+#define __pixelboardd_boardclock_hpp__
+
+#include "p44utils_common.hpp"
+
+#include <map>
+
+namespace p44 {
+
+  class BoardTicket;
+
+  /// Time base for everything happening on the board (animations, game timing, page timers).
+  /// Normally this is just the mainloop's time, and BoardTickets are mainloop timers.
+  /// In simulation mode, time is virtual: it only advances when the simulation calls advanceTo(),
+  /// and BoardTickets are run in order of their virtual due time. This allows running days of
+  /// board activity in minutes.
+  class BoardClock
+  {
+    friend class BoardTicket;
+
+    bool virtualTime; ///< set when running on virtual time
+    MLMicroSeconds virtualNow; ///< current virtual time
+    long timerSerial; ///< to keep timers due at the same time in scheduling order
+
+    typedef std::pair<MLMicroSeconds, long> TimerKey; ///< due time, serial
+    typedef std::map<TimerKey, BoardTicket *> VirtualTimers;
+    VirtualTimers timers; ///< pending virtual timers
+
+    BoardClock();
+
+  public:
+
+    /// @return the shared board clock
+    static BoardClock &sharedClock();
+
+    /// @return current board time
+    static MLMicroSeconds now();
+
+    /// switch to virtual time
+    /// @param aStartTime the virtual time to start at
+    /// @note must be called before any BoardTicket is scheduled
+    void startVirtualTime(MLMicroSeconds aStartTime);
+
+    /// @return true if running on virtual time
+    bool isVirtual() { return virtualTime; };
+
+    /// @return due time of the next pending virtual timer, Infinite if none
+    MLMicroSeconds nextTimerTime();
+
+    /// advance virtual time, running all timers due up to the new time in order
+    /// @param aTime the new virtual time (time never runs backwards)
+    /// @return number of timers run
+    int advanceTo(MLMicroSeconds aTime);
+
+  private:
+
+    TimerKey schedule(BoardTicket *aTicket, MLMicroSeconds aWhen);
+    void unschedule(TimerKey aKey);
+
+  };
+
+
+  /// timer on board time, to be used instead of MLTicket for everything that needs to run in simulated time
+  class BoardTicket
+  {
+    friend class BoardClock;
+
+    MLTicket ticket; ///< the mainloop timer when running on real time
+    SimpleCB callback; ///< the callback when running on virtual time
+    BoardClock::TimerKey virtualKey; ///< key of the virtual timer
+    bool virtualScheduled; ///< set when a virtual timer is pending
+
+    BoardTicket(const BoardTicket &); ///< not copyable
+    BoardTicket &operator=(const BoardTicket &);
+
+  public:
+
+    BoardTicket();
+    ~BoardTicket();
+
+    /// run callback once after a delay, cancelling any callback already scheduled on this ticket
+    /// @param aCallback the callback
+    /// @param aDelay delay from now in board time
+    void executeOnce(SimpleCB aCallback, MLMicroSeconds aDelay = 0);
+
+    /// run callback once at a given time, cancelling any callback already scheduled on this ticket
+    /// @param aCallback the callback
+    /// @param aTime board time when to run the callback
+    void executeOnceAt(SimpleCB aCallback, MLMicroSeconds aTime);
+
+    /// cancel scheduled callback, if any
+    /// @return true if a callback was pending
+    bool cancel();
+
+  };
+
+} // namespace p44
+
+
+#endif /* __pixelboardd_boardclock_hpp__ */
@@ -0,0 +1,179 @@
+//
+//  Copyright (c) 2017 plan44.ch / Lukas Zeller, Zurich, Switzerland
+//
+//  Author: Lukas Zeller <luz@plan44.ch>
+//
+//  This file is part of pixelboardd.
+//
+//  pixelboardd is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  pixelboardd is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with pixelboardd. If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+
+#include "framerenderer.hpp"
+
+using namespace p44;
+
+// MARK: ===== FrameRenderer
+
+FrameRenderer::FrameRenderer(LEDOutputPtr aOutput, int aNumCols, int aNumRows) :
+  output(aOutput),
+  numCols(aNumCols),
+  numRows(aNumRows),
+  snapshotRect(zeroRect),
+  jobPending(false),
+  frameChanged(false),
+  terminating(false),
+  busy(false),
+  framesRendered(0)
+{
+  frame.resize(numCols*numRows, black);
+}
+
+
+FrameRenderer::~FrameRenderer()
+{
+  stopThread();
+}
+
+
+void FrameRenderer::startThread()
+{
+  if (renderThread) return; // already running
+  terminating = false;
+  renderThread = MainLoop::currentMainLoop().executeInThread(
+    boost::bind(&FrameRenderer::renderThreadRoutine, this, _1),
+    boost::bind(&FrameRenderer::renderThreadSignal, this, _1, _2)
+  );
+}
+
+
+void FrameRenderer::stopThread()
+{
+  if (renderThread) {
+    {
+      std::lock_guard<std::mutex> lock(jobMutex);
+      terminating = true;
+    }
+    jobCond.notify_one();
+    renderThread->terminate();
+    renderThread.reset();
+    // thread is gone, whatever it was rendering
+    jobPending = false;
+    snapshot.reset();
+    busy = false;
+  }
+}
+
+
+bool FrameRenderer::renderPage(PixelPage &aPage)
+{
+  if (busy) return false; // changes will be picked up after the current frame
+  PixelRect r = aPage.getDirtyRect();
+  if (renderThread) {
+    // take a snapshot of the changed page and let the render thread composite it
+    MLMicroSeconds start = MainLoop::now();
+    ViewPtr s = aPage.snapshot();
+    aPage.updated();
+    snapshotTimes.add(MainLoop::now()-start);
+    {
+      std::lock_guard<std::mutex> lock(jobMutex);
+      snapshot = s;
+      snapshotRect = r;
+      jobPending = true;
+    }
+    busy = true;
+    jobCond.notify_one();
+  }
+  else {
+    // composite directly from the page
+    bool changed = composite(&aPage, NULL, r);
+    aPage.updated();
+    if (renderedCB) renderedCB(changed);
+  }
+  return true;
+}
+
+
+bool FrameRenderer::composite(PixelPage *aPage, View *aView, PixelRect aRect)
+{
+  MLMicroSeconds start = MainLoop::now();
+  // only recomposite the changed area, rest of the frame remains unchanged
+  for (int y=aRect.y; y<aRect.y+aRect.dy; y++) {
+    PixelColor *row = &frame[y*numCols+aRect.x];
+    if (aPage) {
+      aPage->renderSpan(y, aRect.x, aRect.x+aRect.dx, row);
+    }
+    else if (aView) {
+      aView->renderSpan(y, aRect.x, aRect.x+aRect.dx, row);
+    }
+    else {
+      for (int x=0; x<aRect.dx; x++) row[x] = transparent;
+    }
+    for (int x=0; x<aRect.dx; x++) {
+      row[x].a = 255; // only color goes to the LEDs
+    }
+  }
+  composeTimes.add(MainLoop::now()-start);
+  framesRendered++;
+  // hand over to output (which skips the frame when nothing has changed)
+  return output->submitFrame(&frame[0]);
+}
+
+
+void FrameRenderer::renderThreadRoutine(ChildThreadWrapper &aThread)
+{
+  while (true) {
+    View *view;
+    PixelRect r;
+    {
+      std::unique_lock<std::mutex> lock(jobMutex);
+      while (!terminating && !jobPending) {
+        jobCond.wait(lock);
+      }
+      if (terminating) break;
+      jobPending = false;
+      // only use the raw pointer, snapshot remains owned (and is released) by the main loop
+      view = snapshot.get();
+      r = snapshotRect;
+    }
+    bool changed = composite(NULL, view, r);
+    {
+      std::lock_guard<std::mutex> lock(jobMutex);
+      frameChanged = changed;
+    }
+    // let the main loop know (and release the snapshot there)
+    aThread.signalParentThread(threadSignalUserSignal);
+  }
+}
+
+
+void FrameRenderer::renderThreadSignal(ChildThreadWrapper &aChildThread, ThreadSignals aSignalCode)
+{
+  if (aSignalCode!=threadSignalUserSignal) {
+    LOG(LOG_INFO, "Render thread signals %d", aSignalCode);
+    return;
+  }
+  // frame done
+  ViewPtr done;
+  bool changed;
+  {
+    std::lock_guard<std::mutex> lock(jobMutex);
+    done.swap(snapshot);
+    changed = frameChanged;
+  }
+  busy = false;
+  done.reset(); // release snapshot outside the lock
+  if (renderedCB) renderedCB(changed);
+}
@@ -0,0 +1,132 @@
+//
+//  Copyright (c) 2017 plan44.ch / Lukas Zeller, Zurich, Switzerland
+//
+//  Author: Lukas Zeller <luz@plan44.ch>
+//
+//  This file is part of pixelboardd.
+//
+//  pixelboardd is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  pixelboardd is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with pixelboardd. If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+
+#ifndef __pixelboardd_framerenderer_hpp__
+#define __pixelboardd_framerenderer_hpp__
+
+#include "p44utils_common.hpp"
+#include "pixelpage.hpp"
+#include "ledoutput.hpp"
+#include "stats.hpp"
+
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+
+namespace p44 {
+
+  /// called on the main loop when a frame has been composited and submitted to the LED output
+  /// @param aChanged set if the frame differs from the previous one (and will be transmitted)
+  typedef boost::function<void (bool aChanged)> FrameRenderedCB;
+
+
+  /// Composites the changed area of a page into a frame and submits it to the LED output, either directly
+  /// from the main loop, or from a separate render thread.
+  /// The render thread never accesses the live page: at the frame boundary, the main loop takes a snapshot
+  /// of the page's view tree, and the render thread composites the snapshot while the main loop continues
+  /// to step pages, poll inputs and handle API requests. Snapshots are created and released on the main loop,
+  /// so the render thread never changes any reference counts.
+  class FrameRenderer : public P44Obj
+  {
+    LEDOutputPtr output; ///< where composited frames go
+    int numCols; ///< number of columns in a frame
+    int numRows; ///< number of rows in a frame
+    std::vector<PixelColor> frame; ///< current composited frame, row by row. Only accessed by the render thread while busy.
+    FrameRenderedCB renderedCB; ///< called on the main loop for every frame rendered
+
+    // render thread
+    ChildThreadWrapperPtr renderThread; ///< the render thread, NULL if frames are composited on the main loop
+    std::mutex jobMutex; ///< protects the job variables below
+    std::condition_variable jobCond; ///< signalled when a job is pending or the thread must terminate
+    ViewPtr snapshot; ///< snapshot being rendered, NULL if the page shows nothing. Owned by the main loop.
+    PixelRect snapshotRect; ///< area of the frame to render from snapshot
+    bool jobPending; ///< set when snapshot is ready and not yet taken by the render thread
+    bool frameChanged; ///< set when the last frame rendered by the thread differed from the previous one
+    bool terminating; ///< set to make the render thread terminate
+    bool busy; ///< only used on the main loop: set from handing over a snapshot until the thread has reported back
+
+    // statistics
+    std::atomic<long> framesRendered; ///< number of frames composited
+    LatencyHistogram composeTimes; ///< time spent compositing changed areas of the frame
+    LatencyHistogram snapshotTimes; ///< time the main loop spends taking snapshots
+
+  public :
+
+    /// create frame renderer
+    /// @param aOutput the LED output to submit frames to
+    /// @param aNumCols number of columns of the frames
+    /// @param aNumRows number of rows of the frames
+    FrameRenderer(LEDOutputPtr aOutput, int aNumCols, int aNumRows);
+
+    virtual ~FrameRenderer();
+
+    /// set handler to be called on the main loop for every rendered frame
+    /// @param aRenderedCB handler. With the render thread, this is the time to render changes that
+    ///   were made while the previous frame was being rendered.
+    void setFrameRenderedHandler(FrameRenderedCB aRenderedCB) { renderedCB = aRenderedCB; };
+
+    /// start the render thread
+    /// @note without render thread, pages are composited directly from renderPage()
+    void startThread();
+
+    /// stop the render thread, further frames will be composited on the main loop
+    void stopThread();
+
+    /// @return true if the render thread is still working on the previous frame
+    bool isBusy() { return busy; };
+
+    /// composite the changed area of a page and submit the frame to the LED output
+    /// @param aPage the page to render. It is marked updated when its changes are taken over.
+    /// @return false if the render thread is still busy with the previous frame. The page remains dirty then,
+    ///   and should be rendered again from the frame rendered handler.
+    bool renderPage(PixelPage &aPage);
+
+    /// @return number of frames composited
+    long getFramesRendered() { return framesRendered; };
+
+    /// @return histogram of the time spent compositing frames
+    LatencyHistogram &getComposeTimes() { return composeTimes; };
+
+    /// @return histogram of the time the main loop spends taking snapshots for the render thread
+    LatencyHistogram &getSnapshotTimes() { return snapshotTimes; };
+
+  private:
+
+    /// composite an area of the frame and submit the frame to the output
+    /// @param aPage page to render from, or NULL to render from aView
+    /// @param aView view to render from when aPage is NULL. If both are NULL, the area is rendered black.
+    /// @param aRect the area to composite
+    /// @return true if the frame has changed
+    bool composite(PixelPage *aPage, View *aView, PixelRect aRect);
+
+    void renderThreadRoutine(ChildThreadWrapper &aThread);
+    void renderThreadSignal(ChildThreadWrapper &aChildThread, ThreadSignals aSignalCode);
+
+  };
+  typedef boost::intrusive_ptr<FrameRenderer> FrameRendererPtr;
+
+} // namespace p44
+
+
+
+#endif /* __pixelboardd_framerenderer_hpp__ */
@@ -0,0 +1,623 @@
+//
+//  Copyright (c) 2017 plan44.ch / Lukas Zeller, Zurich, Switzerland
+//
+//  Author: Lukas Zeller <luz@plan44.ch>
+//
+//  This file is part of pixelboardd.
+//
+//  pixelboardd is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  pixelboardd is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with pixelboardd. If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#include "imagecache.hpp"
+#include "resourcebundle.hpp"
+#include "application.hpp"
+
+#include <png.h>
+
+using namespace p44;
+
+#define DEFAULT_IMAGE_CACHE_BUDGET (1024*1024) // enough for a lot of board sized images
+
+
+// MARK: ===== FileVersion
+
+FileVersion::FileVersion() :
+  mtime(0),
+  mtimeNs(0),
+  inode(0),
+  size(0)
+{
+}
+
+
+FileVersion::FileVersion(const struct stat &aStat) :
+  mtime(aStat.st_mtime),
+  inode(aStat.st_ino),
+  size(aStat.st_size)
+{
+  // seconds alone miss a file rewritten within the same second
+  #if defined(__APPLE__)
+  mtimeNs = aStat.st_mtimespec.tv_nsec;
+  #else
+  mtimeNs = aStat.st_mtim.tv_nsec;
+  #endif
+}
+
+
+bool FileVersion::operator==(const FileVersion &aOther) const
+{
+  return mtime==aOther.mtime && mtimeNs==aOther.mtimeNs && inode==aOther.inode && size==aOther.size;
+}
+
+
+// MARK: ===== PNGRowReader
+
+PNGRowReader::PNGRowReader() :
+  file(NULL),
+  png(NULL),
+  info(NULL),
+  sizeX(0),
+  sizeY(0),
+  nextRow(0)
+{
+}
+
+
+PNGRowReader::~PNGRowReader()
+{
+  close();
+}
+
+
+void PNGRowReader::close()
+{
+  if (png) {
+    png_destroy_read_struct(&png, info ? &info : NULL, NULL);
+    png = NULL;
+    info = NULL;
+  }
+  if (file) {
+    fclose(file);
+    file = NULL;
+  }
+  sizeX = 0;
+  sizeY = 0;
+  nextRow = 0;
+}
+
+
+ErrorPtr PNGRowReader::open(const string aPNGFileName)
+{
+  close();
+  fileName = aPNGFileName;
+  file = fopen(aPNGFileName.c_str(), "rb");
+  if (!file) {
+    return SysError::errNo("cannot open PNG file: ");
+  }
+  png = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+  if (png) info = png_create_info_struct(png);
+  if (!info) {
+    close();
+    return TextError::err("cannot create PNG reader for %s", aPNGFileName.c_str());
+  }
+  if (setjmp(png_jmpbuf(png))) {
+    // libpng error
+    close();
+    return TextError::err("could not read PNG file %s", aPNGFileName.c_str());
+  }
+  png_init_io(png, file);
+  png_read_info(png, info);
+  if (png_get_interlace_type(png, info)!=PNG_INTERLACE_NONE) {
+    close();
+    return TextError::err("PNG file %s is interlaced and cannot be decoded row by row", aPNGFileName.c_str());
+  }
+  // always deliver 8 bit RGBA
+  png_set_expand(png); // palette and low bit depths to 8 bit, transparent color to alpha
+  png_set_strip_16(png);
+  png_set_gray_to_rgb(png);
+  png_set_add_alpha(png, 0xFF, PNG_FILLER_AFTER);
+  png_read_update_info(png, info);
+  sizeX = png_get_image_width(png, info);
+  sizeY = png_get_image_height(png, info);
+  if (png_get_rowbytes(png, info)!=(size_t)sizeX*4) {
+    close();
+    return TextError::err("PNG file %s cannot be converted to RGBA", aPNGFileName.c_str());
+  }
+  rowBuffer.resize(sizeX*4);
+  nextRow = 0;
+  return ErrorPtr();
+}
+
+
+ErrorPtr PNGRowReader::readRows(int aNumRows, PixelColor *aPixels, int aRowStride)
+{
+  if (!png) {
+    return TextError::err("PNG file %s is not open", fileName.c_str());
+  }
+  if (nextRow+aNumRows>sizeY) {
+    return TextError::err("PNG file %s has only %d rows", fileName.c_str(), sizeY);
+  }
+  if (setjmp(png_jmpbuf(png))) {
+    // libpng error, e.g. truncated file
+    close();
+    return TextError::err("Error reading PNG file %s", fileName.c_str());
+  }
+  for (int i=0; i<aNumRows; i++) {
+    png_read_row(png, &rowBuffer[0], NULL);
+    nextRow++;
+    if (aPixels) {
+      // convert to premultiplied alpha
+      PixelColor *pix = aPixels+i*aRowStride;
+      const uint8_t *p = &rowBuffer[0];
+      for (int x=0; x<sizeX; x++, p+=4) {
+        pix[x].a = p[3];
+        if (p[3]==255) {
+          pix[x].r = p[0];
+          pix[x].g = p[1];
+          pix[x].b = p[2];
+        }
+        else {
+          pix[x].r = dimVal(p[0], p[3]);
+          pix[x].g = dimVal(p[1], p[3]);
+          pix[x].b = dimVal(p[2], p[3]);
+        }
+      }
+    }
+  }
+  return ErrorPtr();
+}
+
+
+// MARK: ===== DecodedImage
+
+DecodedImage::DecodedImage() :
+  sizeX(0),
+  sizeY(0),
+  pixelData(NULL),
+  opaque(false),
+  binaryAlpha(false),
+  users(0)
+{
+}
+
+
+DecodedImagePtr DecodedImage::copy() const
+{
+  DecodedImagePtr img = DecodedImagePtr(new DecodedImage);
+  img->sizeX = sizeX;
+  img->sizeY = sizeY;
+  if (pixelData) {
+    img->pixels.assign(pixelData, pixelData+sizeX*sizeY);
+    img->pixelData = &img->pixels[0];
+  }
+  img->opaque = opaque;
+  img->binaryAlpha = binaryAlpha;
+  return img;
+}
+
+
+// area average downscaling: each target pixel is the average of the source area it covers,
+// partially covered source pixels weighted by coverage.
+// Source pixel widths are measured in 1/aDstX units, heights in 1/aDstY units, so all overlaps are integers
+
+/// horizontal pass: sums of each target column's source area in one source row (weight total aSrcX)
+/// @param aSums receives aDstX*4 sums (RGBA per target column)
+static void areaAverageRow(const PixelColor *aSrcRow, int aSrcX, uint64_t *aSums, int aDstX)
+{
+  for (int tx=0; tx<aDstX; tx++) {
+    int64_t lo = (int64_t)tx*aSrcX;
+    int64_t hi = lo+aSrcX;
+    for (int sx = (int)(lo/aDstX); sx<aSrcX && (int64_t)sx*aDstX<hi; sx++) {
+      uint64_t w = min(hi, (int64_t)(sx+1)*aDstX) - max(lo, (int64_t)sx*aDstX);
+      aSums[tx*4+0] += aSrcRow[sx].r*w;
+      aSums[tx*4+1] += aSrcRow[sx].g*w;
+      aSums[tx*4+2] += aSrcRow[sx].b*w;
+      aSums[tx*4+3] += aSrcRow[sx].a*w;
+    }
+  }
+}
+
+
+/// vertical pass over the row sums of all source rows (weight total aSrcX*aSrcY)
+static void areaAverageColumns(const uint64_t *aRowSums, int aSrcX, int aSrcY, PixelColor *aDst, int aDstX, int aDstY)
+{
+  uint64_t total = (uint64_t)aSrcX*aSrcY;
+  for (int ty=0; ty<aDstY; ty++) {
+    int64_t lo = (int64_t)ty*aSrcY;
+    int64_t hi = lo+aSrcY;
+    for (int tx=0; tx<aDstX; tx++) {
+      uint64_t acc[4] = { 0, 0, 0, 0 };
+      for (int sy = (int)(lo/aDstY); sy<aSrcY && (int64_t)sy*aDstY<hi; sy++) {
+        uint64_t w = min(hi, (int64_t)(sy+1)*aDstY) - max(lo, (int64_t)sy*aDstY);
+        const uint64_t *sums = &aRowSums[(sy*aDstX+tx)*4];
+        for (int c=0; c<4; c++) acc[c] += sums[c]*w;
+      }
+      PixelColor &d = aDst[ty*aDstX+tx];
+      d.r = (uint8_t)((acc[0]+total/2)/total);
+      d.g = (uint8_t)((acc[1]+total/2)/total);
+      d.b = (uint8_t)((acc[2]+total/2)/total);
+      d.a = (uint8_t)((acc[3]+total/2)/total);
+    }
+  }
+}
+
+
+/// calculate the size an image must be downscaled to for fitting into a max size (keeping aspect ratio)
+/// @return true if the image needs downscaling, false if it fits as is
+static bool fitSize(int aSizeX, int aSizeY, int aMaxSizeX, int aMaxSizeY, int &aFitX, int &aFitY)
+{
+  if ((aMaxSizeX<=0 || aSizeX<=aMaxSizeX) && (aMaxSizeY<=0 || aSizeY<=aMaxSizeY)) return false;
+  int mx = aMaxSizeX>0 ? aMaxSizeX : aSizeX;
+  int my = aMaxSizeY>0 ? aMaxSizeY : aSizeY;
+  if ((int64_t)aSizeX*my > (int64_t)aSizeY*mx) {
+    // wider than max area, width limits
+    aFitX = mx;
+    aFitY = (int)(((int64_t)aSizeY*mx+aSizeX/2)/aSizeX);
+  }
+  else {
+    aFitY = my;
+    aFitX = (int)(((int64_t)aSizeX*my+aSizeY/2)/aSizeY);
+  }
+  aFitX = max(aFitX, 1);
+  aFitY = max(aFitY, 1);
+  return true;
+}
+
+
+ErrorPtr DecodedImage::loadPNG(const string aPNGFileName, int aMaxSizeX, int aMaxSizeY)
+{
+  if (aMaxSizeX>0 || aMaxSizeY>0) {
+    // downscaling might be needed: if possible, decode row by row, so the full size image is never in memory
+    PNGRowReader reader;
+    int fx, fy;
+    if (Error::isOK(reader.open(aPNGFileName)) && fitSize(reader.getSizeX(), reader.getSizeY(), aMaxSizeX, aMaxSizeY, fx, fy)) {
+      LOG(LOG_INFO, "Image %s: %d*%d pixels, decoding downscaled to %d*%d pixels", aPNGFileName.c_str(), reader.getSizeX(), reader.getSizeY(), fx, fy);
+      return loadScaledPNG(reader, fx, fy);
+    }
+    // fits anyway, or cannot be read row by row (interlaced): decode entire image below
+  }
+  png_image pngImage; // The control structure used by libpng
+  memset(&pngImage, 0, (sizeof pngImage));
+  pngImage.version = PNG_IMAGE_VERSION;
+  if (png_image_begin_read_from_file(&pngImage, aPNGFileName.c_str()) == 0) {
+    // error
+    return TextError::err("could not open PNG file %s", aPNGFileName.c_str());
+  }
+  pngImage.format = PNG_FORMAT_RGBA;
+  sizeX = pngImage.width;
+  sizeY = pngImage.height;
+  LOG(LOG_INFO, "Image %s: %d*%d pixels, %d bytes", aPNGFileName.c_str(), sizeX, sizeY, PNG_IMAGE_SIZE(pngImage));
+  pixels.resize(sizeX*sizeY);
+  pixelData = &pixels[0];
+  // read the image bottom row first (negative row stride), so rows are in content coordinates
+  if (png_image_finish_read(
+    &pngImage,
+    NULL, // background
+    &pixels[0],
+    -sizeX*4, // row_stride
+    NULL //colormap
+  ) == 0) {
+    // error
+    ErrorPtr err = TextError::err("Error reading PNG file %s: error: %s", aPNGFileName.c_str(), pngImage.message);
+    png_image_free(&pngImage);
+    pixels.clear();
+    pixelData = NULL;
+    sizeX = 0;
+    sizeY = 0;
+    return err;
+  }
+  // convert to premultiplied alpha once, so rendering does not need to
+  // (also required before averaging pixels for downscaling)
+  for (size_t i=0; i<pixels.size(); i++) {
+    PixelColor &pix = pixels[i];
+    if (pix.a!=255) {
+      pix.r = dimVal(pix.r, pix.a);
+      pix.g = dimVal(pix.g, pix.a);
+      pix.b = dimVal(pix.b, pix.a);
+    }
+  }
+  // fit into max size
+  int fx, fy;
+  if (fitSize(sizeX, sizeY, aMaxSizeX, aMaxSizeY, fx, fy)) {
+    LOG(LOG_INFO, "Image %s: downscaled to %d*%d pixels", aPNGFileName.c_str(), fx, fy);
+    downscale(fx, fy);
+  }
+  // check for opacity, so views below can be skipped when covered
+  updateAlphaInfo();
+  return ErrorPtr();
+}
+
+
+ErrorPtr DecodedImage::loadScaledPNG(PNGRowReader &aReader, int aSizeX, int aSizeY)
+{
+  int srcX = aReader.getSizeX();
+  int srcY = aReader.getSizeY();
+  // horizontal averaging pass per source row as it is decoded
+  std::vector<PixelColor> row(srcX);
+  std::vector<uint64_t> rowSums(aSizeX*srcY*4, 0);
+  for (int y=srcY-1; y>=0; y--) {
+    // file has top row first, content coordinates bottom row first
+    ErrorPtr err = aReader.readRows(1, &row[0], 0);
+    if (!Error::isOK(err)) return err;
+    areaAverageRow(&row[0], srcX, &rowSums[y*aSizeX*4], aSizeX);
+  }
+  aReader.close();
+  pixels.resize(aSizeX*aSizeY);
+  pixelData = &pixels[0];
+  sizeX = aSizeX;
+  sizeY = aSizeY;
+  areaAverageColumns(&rowSums[0], srcX, srcY, &pixels[0], aSizeX, aSizeY);
+  updateAlphaInfo();
+  return ErrorPtr();
+}
+
+
+void DecodedImage::updateAlphaInfo()
+{
+  opaque = true;
+  binaryAlpha = true;
+  for (int i=0; i<sizeX*sizeY; i++) {
+    uint8_t a = pixelData[i].a;
+    if (a!=255) {
+      opaque = false;
+      if (a!=0) {
+        binaryAlpha = false;
+        break;
+      }
+    }
+  }
+}
+
+
+void DecodedImage::downscale(int aSizeX, int aSizeY)
+{
+  std::vector<uint64_t> rowSums(aSizeX*sizeY*4, 0);
+  for (int y=0; y<sizeY; y++) {
+    areaAverageRow(pixelData+y*sizeX, sizeX, &rowSums[y*aSizeX*4], aSizeX);
+  }
+  std::vector<PixelColor> scaled(aSizeX*aSizeY);
+  areaAverageColumns(&rowSums[0], sizeX, sizeY, &scaled[0], aSizeX, aSizeY);
+  pixels.swap(scaled); // releases the full size pixels
+  pixelData = &pixels[0];
+  sizeX = aSizeX;
+  sizeY = aSizeY;
+}
+
+
+// MARK: ===== ImageCache
+
+ImageCache::ImageCache() :
+  budget(DEFAULT_IMAGE_CACHE_BUDGET),
+  bytesCached(0),
+  hits(0),
+  misses(0),
+  evictions(0)
+{
+}
+
+
+ImageCache &ImageCache::sharedImageCache()
+{
+  // intentionally never destroyed: views held by other static objects (e.g. the application's pages)
+  // still report to the cache from their destructors during static destruction
+  static ImageCache *cache = new ImageCache;
+  return *cache;
+}
+
+
+void ImageCache::setBudget(size_t aMaxBytes)
+{
+  budget = aMaxBytes;
+  trim();
+}
+
+
+DecodedImagePtr ImageCache::cachedImage(const string aFileName, const FileVersion &aVersion)
+{
+  CacheMap::iterator pos = entries.find(aFileName);
+  if (pos==entries.end()) return DecodedImagePtr();
+  if (pos->second.version!=aVersion) {
+    // file has changed, forget old version (views still showing it keep it alive)
+    bytesCached -= pos->second.image->byteSize();
+    lru.erase(pos->second.lruPos);
+    entries.erase(pos);
+    return DecodedImagePtr();
+  }
+  // cached and still valid
+  hits++;
+  lru.splice(lru.begin(), lru, pos->second.lruPos);
+  return pos->second.image;
+}
+
+
+void ImageCache::addImage(const string aFileName, const FileVersion &aVersion, DecodedImagePtr aImage)
+{
+  CacheMap::iterator pos = entries.find(aFileName);
+  if (pos!=entries.end()) {
+    // replace previous version
+    bytesCached -= pos->second.image->byteSize();
+    lru.erase(pos->second.lruPos);
+    entries.erase(pos);
+  }
+  CacheEntry &e = entries[aFileName];
+  e.image = aImage;
+  e.version = aVersion;
+  lru.push_front(aFileName);
+  e.lruPos = lru.begin();
+  bytesCached += aImage->byteSize();
+  trim();
+}
+
+
+string ImageCache::cacheKey(const string aFileName, int aMaxSizeX, int aMaxSizeY)
+{
+  if (aMaxSizeX<=0 && aMaxSizeY<=0) return aFileName;
+  return string_format("%s@%dx%d", aFileName.c_str(), aMaxSizeX, aMaxSizeY);
+}
+
+
+ErrorPtr ImageCache::getImage(const string aPNGFileName, DecodedImagePtr &aImage, int aMaxSizeX, int aMaxSizeY)
+{
+  struct stat st;
+  if (stat(aPNGFileName.c_str(), &st)!=0) {
+    return SysError::errNo("cannot access image: ");
+  }
+  string key = cacheKey(aPNGFileName, aMaxSizeX, aMaxSizeY);
+  aImage = cachedImage(key, FileVersion(st));
+  if (aImage) return ErrorPtr();
+  misses++;
+  DecodedImagePtr img = DecodedImagePtr(new DecodedImage);
+  ErrorPtr err = img->loadPNG(aPNGFileName, aMaxSizeX, aMaxSizeY);
+  if (!Error::isOK(err)) return err;
+  addImage(key, FileVersion(st), img);
+  aImage = img;
+  return ErrorPtr();
+}
+
+
+void ImageCache::loadImageInBackground(const string aPNGFileName, ImageLoadedCB aLoadedCB, int aMaxSizeX, int aMaxSizeY, bool aCache)
+{
+  struct stat st;
+  if (stat(aPNGFileName.c_str(), &st)!=0) {
+    if (aLoadedCB) aLoadedCB(SysError::errNo("cannot access image: "), DecodedImagePtr());
+    return;
+  }
+  string key = cacheKey(aPNGFileName, aMaxSizeX, aMaxSizeY);
+  if (aCache) {
+    DecodedImagePtr img = cachedImage(key, FileVersion(st));
+    if (img) {
+      if (aLoadedCB) aLoadedCB(ErrorPtr(), img);
+      return;
+    }
+    misses++;
+  }
+  // decode in a separate thread, the main loop keeps running
+  ImageLoaderPtr loader = ImageLoaderPtr(new ImageLoader);
+  loader->fileName = aPNGFileName;
+  loader->key = key;
+  loader->maxSizeX = aMaxSizeX;
+  loader->maxSizeY = aMaxSizeY;
+  loader->version = FileVersion(st);
+  loader->cache = aCache;
+  loader->image = DecodedImagePtr(new DecodedImage);
+  loader->loadedCB = aLoadedCB;
+  loaders.push_back(loader);
+  loader->thread = MainLoop::currentMainLoop().executeInThread(
+    boost::bind(&ImageCache::loaderThreadRoutine, this, loader.get()),
+    boost::bind(&ImageCache::loaderThreadSignal, this, loader, _2)
+  );
+}
+
+
+void ImageCache::loaderThreadRoutine(ImageLoader *aLoader)
+{
+  // only touches the loader's own objects, and not their reference counts
+  // (loader is kept alive by the loaders list until the thread has ended)
+  aLoader->error = aLoader->image->loadPNG(aLoader->fileName, aLoader->maxSizeX, aLoader->maxSizeY);
+}
+
+
+void ImageCache::loaderThreadSignal(ImageLoaderPtr aLoader, ThreadSignals aSignalCode)
+{
+  if (aSignalCode!=threadSignalCompleted && aSignalCode!=threadSignalFailedToStart && aSignalCode!=threadSignalCancelled) return;
+  // decoding has ended, back on the main thread now
+  loaders.remove(aLoader);
+  aLoader->thread.reset();
+  if (aSignalCode!=threadSignalCompleted) {
+    aLoader->error = TextError::err("could not decode %s in background", aLoader->fileName.c_str());
+  }
+  DecodedImagePtr img;
+  if (Error::isOK(aLoader->error)) {
+    img = aLoader->image;
+    if (aLoader->cache) addImage(aLoader->key, aLoader->version, img);
+  }
+  if (aLoader->loadedCB) aLoader->loadedCB(aLoader->error, img);
+}
+
+
+ErrorPtr ImageCache::getResourceImage(const string aResourceName, DecodedImagePtr &aImage)
+{
+  ResourceBundle &bundle = ResourceBundle::sharedBundle();
+  if (bundle.isOpen()) {
+    string key = "bundle:"+aResourceName;
+    aImage = cachedImage(key, FileVersion());
+    if (aImage) return ErrorPtr();
+    DecodedImagePtr img = bundle.getImage(aResourceName);
+    if (img) {
+      // mapped from bundle, no decoding and no memory to account for
+      misses++;
+      addImage(key, FileVersion(), img);
+      aImage = img;
+      return ErrorPtr();
+    }
+  }
+  // not bundled, use loose file
+  return getImage(Application::sharedApplication()->resourcePath(aResourceName), aImage);
+}
+
+
+void ImageCache::useImage(DecodedImagePtr aImage, bool aInUse)
+{
+  if (!aImage) return;
+  if (aInUse) {
+    aImage->users++;
+  }
+  else if (aImage->users>0) {
+    aImage->users--;
+    if (aImage->users==0) trim(); // might be evicted now
+  }
+}
+
+
+size_t ImageCache::getBytesInUse()
+{
+  size_t bytes = 0;
+  for (CacheMap::iterator pos = entries.begin(); pos!=entries.end(); ++pos) {
+    if (pos->second.image->users>0) bytes += pos->second.image->byteSize();
+  }
+  return bytes;
+}
+
+
+void ImageCache::trim()
+{
+  if (lru.empty()) return;
+  // never evict the most recently used image, it might just be about to be shown
+  std::list<string>::iterator mru = lru.begin();
+  std::list<string>::iterator pos = lru.end();
+  while (bytesCached>budget && --pos!=mru) {
+    CacheMap::iterator e = entries.find(*pos);
+    if (e->second.image->users>0) continue; // in use, cannot be evicted
+    LOG(LOG_INFO, "Evicting image %s from cache", pos->c_str());
+    bytesCached -= e->second.image->byteSize();
+    entries.erase(e);
+    pos = lru.erase(pos); // loop continues with the next more recently used entry
+    evictions++;
+  }
+}
+
+
+JsonObjectPtr ImageCache::json()
+{
+  JsonObjectPtr j = JsonObject::newObj();
+  j->add("images", JsonObject::newInt64(entries.size()));
+  j->add("bytesCached", JsonObject::newInt64(bytesCached));
+  j->add("bytesInUse", JsonObject::newInt64(getBytesInUse()));
+  j->add("budget", JsonObject::newInt64(budget));
+  j->add("hits", JsonObject::newInt64(hits));
+  j->add("misses", JsonObject::newInt64(misses));
+  j->add("evictions", JsonObject::newInt64(evictions));
+  return j;
+}
@@ -0,0 +1,312 @@
+//
+//  Copyright (c) 2017 plan44.ch / Lukas Zeller, Zurich, Switzerland
+//
+//  Author: Lukas Zeller <luz@plan44.ch>
+//
+//  This file is part of pixelboardd.
+//
+//  pixelboardd is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  pixelboardd is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with pixelboardd. If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#ifndef __pixelboardd_imagecache_hpp__
+#define __pixelboardd_imagecache_hpp__
+
+#include "p44utils_common.hpp"
+#include "jsonobject.hpp"
+#include "view.hpp"
+
+#include <map>
+#include <list>
+#include <stdio.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+struct png_struct_def;
+struct png_info_def;
+
+namespace p44 {
+
+  class ImageCache;
+  class ResourceBundle;
+  class DecodedImage;
+  typedef boost::intrusive_ptr<DecodedImage> DecodedImagePtr;
+
+  /// sequential reader for the rows of a (non-interlaced) PNG file, for decoding parts of large images
+  /// without ever having the entire image in memory
+  class PNGRowReader
+  {
+    string fileName; ///< the file being read
+    FILE *file;
+    struct png_struct_def *png;
+    struct png_info_def *info;
+    int sizeX; ///< width in pixels
+    int sizeY; ///< height in pixels
+    int nextRow; ///< next row to be read (0 is the top row of the image file)
+    std::vector<uint8_t> rowBuffer; ///< one row, RGBA
+
+  public:
+
+    PNGRowReader();
+    ~PNGRowReader();
+
+    /// open a PNG file for reading rows
+    /// @param aPNGFileName the file to read
+    /// @return ok or error
+    ErrorPtr open(const string aPNGFileName);
+
+    /// close the file
+    void close();
+
+    /// @return true if open
+    bool isOpen() { return png!=NULL; };
+
+    /// @return width in pixels
+    int getSizeX() { return sizeX; };
+
+    /// @return height in pixels
+    int getSizeY() { return sizeY; };
+
+    /// @return the next row that will be read (0 is the top row of the image file)
+    int getNextRow() { return nextRow; };
+
+    /// read the next rows
+    /// @param aNumRows number of rows to read
+    /// @param aPixels receives the pixels, premultiplied alpha. If NULL, the rows are skipped.
+    /// @param aRowStride offset from one row to the next in aPixels, negative for filling bottom up
+    /// @return ok or error
+    ErrorPtr readRows(int aNumRows, PixelColor *aPixels, int aRowStride);
+
+  };
+
+
+  /// Decoded image, in premultiplied alpha. The pixels are immutable once decoded,
+  /// so the same image can be shown by any number of views.
+  class DecodedImage : public P44Obj
+  {
+    friend class ImageCache;
+    friend class ImageView;
+    friend class AnimatedImageView;
+    friend class ResourceBundle;
+
+    int sizeX; ///< width in pixels
+    int sizeY; ///< height in pixels
+    std::vector<PixelColor> pixels; ///< decoded pixels, empty for images mapped from a resource bundle
+    const PixelColor *pixelData; ///< pixels in content coordinates (row 0 is the bottom row of the image file)
+    bool opaque; ///< all pixels are fully opaque
+    bool binaryAlpha; ///< all pixels are either fully opaque or fully transparent
+    int users; ///< number of views currently showing this image
+
+  public:
+
+    DecodedImage();
+
+    /// decode a PNG file
+    /// @param aPNGFileName the file to decode
+    /// @param aMaxSizeX if>0, images wider than this are downscaled to fit (keeping aspect ratio)
+    /// @param aMaxSizeY if>0, images higher than this are downscaled to fit (keeping aspect ratio)
+    /// @return ok or error
+    /// @note downscaling averages all source pixels covering a target pixel. Non-interlaced images are decoded
+    ///   row by row directly into the downscaled image, so a large photo never needs its full size in memory
+    ErrorPtr loadPNG(const string aPNGFileName, int aMaxSizeX = 0, int aMaxSizeY = 0);
+
+    /// @return width in pixels
+    int getSizeX() const { return sizeX; };
+
+    /// @return height in pixels
+    int getSizeY() const { return sizeY; };
+
+    /// @return pixel at X,Y (must be within the image), premultiplied alpha
+    const PixelColor &pixelAt(int aX, int aY) const { return pixelData[aY*sizeX+aX]; };
+
+    /// @return all pixels, row by row in content coordinates
+    const PixelColor *getPixels() const { return pixelData; };
+
+    /// @return true if all pixels are fully opaque
+    bool isOpaque() const { return opaque; };
+
+    /// @return true if all pixels are either fully opaque or fully transparent
+    bool isBinaryAlpha() const { return binaryAlpha; };
+
+    /// @return memory allocated for the pixels (0 for images mapped from a resource bundle)
+    size_t byteSize() const { return pixels.size()*sizeof(PixelColor); };
+
+    /// @return a copy of this image with its own pixels
+    /// @note needed for the frame buffers of an AnimatedImageView, which are decoded into again later
+    DecodedImagePtr copy() const;
+
+  private:
+
+    /// replace pixels by an area averaged downscaled version
+    void downscale(int aSizeX, int aSizeY);
+
+    /// decode an image row by row, directly into an area averaged downscaled version
+    /// @param aReader the opened image, with no rows read yet
+    /// @param aSizeX target width
+    /// @param aSizeY target height
+    /// @return ok or error
+    /// @note only the horizontally averaged rows are kept during decoding, never the full size image
+    ErrorPtr loadScaledPNG(PNGRowReader &aReader, int aSizeX, int aSizeY);
+
+    /// update opaque and binaryAlpha from the pixels
+    void updateAlphaInfo();
+
+  };
+
+  /// identifies a version of an image file, to detect when it has changed
+  class FileVersion
+  {
+  public:
+    time_t mtime; ///< modification time, seconds
+    long mtimeNs; ///< modification time, nanoseconds
+    ino_t inode; ///< inode, differs when a file was replaced by a new one with the same name
+    off_t size; ///< file size
+
+    FileVersion();
+
+    /// @param aStat the file status to take the version from
+    explicit FileVersion(const struct stat &aStat);
+
+    bool operator==(const FileVersion &aOther) const;
+    bool operator!=(const FileVersion &aOther) const { return !(*this==aOther); };
+  };
+
+
+  /// callback for images loaded in background
+  /// @param aError ok or error
+  /// @param aImage the decoded image (NULL on error)
+  typedef boost::function<void (ErrorPtr aError, DecodedImagePtr aImage)> ImageLoadedCB;
+
+
+  /// loads an image in a background thread
+  class ImageLoader : public P44Obj
+  {
+    friend class ImageCache;
+
+    string fileName; ///< the file to decode
+    string key; ///< the cache key
+    int maxSizeX; ///< max width, 0 for no limit
+    int maxSizeY; ///< max height, 0 for no limit
+    FileVersion version; ///< version of the file when it was decoded
+    bool cache; ///< if set, the decoded image is added to the cache
+    DecodedImagePtr image; ///< the image being decoded
+    ErrorPtr error; ///< result of decoding
+    ImageLoadedCB loadedCB; ///< called on the main thread when done
+    ChildThreadWrapperPtr thread; ///< the decoding thread
+  };
+  typedef boost::intrusive_ptr<ImageLoader> ImageLoaderPtr;
+
+
+  /// Cache of decoded images. Every image file is decoded once and shared between all views showing it.
+  /// Images no longer shown by any view are kept as long as the total stays within the memory budget,
+  /// and are evicted least recently used first when the budget is exceeded.
+  class ImageCache
+  {
+    class CacheEntry
+    {
+    public:
+      DecodedImagePtr image;
+      FileVersion version; ///< version of the file when it was decoded
+      std::list<string>::iterator lruPos; ///< position in lru list
+    };
+    typedef std::map<string, CacheEntry> CacheMap;
+
+    CacheMap entries; ///< the cached images by file name
+    std::list<ImageLoaderPtr> loaders; ///< images currently being decoded in background
+    std::list<string> lru; ///< file names, most recently used first
+    size_t budget; ///< max bytes for decoded images (unless more are in use)
+    size_t bytesCached; ///< bytes of all images in the cache, in use or not
+
+    // statistics
+    long hits;
+    long misses;
+    long evictions;
+
+    ImageCache();
+
+  public:
+
+    /// @return the shared image cache
+    static ImageCache &sharedImageCache();
+
+    /// set the memory budget
+    /// @param aMaxBytes max bytes to use for decoded images. Images in use are never evicted,
+    ///   so this can be exceeded when views show more than this.
+    void setBudget(size_t aMaxBytes);
+
+    /// get decoded image, decode it if not yet cached (or when the file has changed since)
+    /// @param aPNGFileName the PNG file
+    /// @param aImage will be set to the decoded image
+    /// @param aMaxSizeX if>0, the image is downscaled to be no wider than this
+    /// @param aMaxSizeY if>0, the image is downscaled to be no higher than this
+    /// @return ok or error
+    /// @note images downscaled to different sizes are cached separately
+    ErrorPtr getImage(const string aPNGFileName, DecodedImagePtr &aImage, int aMaxSizeX = 0, int aMaxSizeY = 0);
+
+    /// get decoded image without blocking the main loop, decode it in a background thread if not yet cached
+    /// (or when the file has changed since)
+    /// @param aPNGFileName the PNG file. It must not be removed before aLoadedCB is called.
+    /// @param aLoadedCB called on the main thread when the image is ready, or could not be decoded
+    /// @param aMaxSizeX if>0, the image is downscaled to be no wider than this
+    /// @param aMaxSizeY if>0, the image is downscaled to be no higher than this
+    /// @param aCache if not set, the image is decoded without looking it up in or adding it to the cache,
+    ///   e.g. for temporary files that are never loaded again
+    void loadImageInBackground(const string aPNGFileName, ImageLoadedCB aLoadedCB, int aMaxSizeX = 0, int aMaxSizeY = 0, bool aCache = true);
+
+    /// get decoded image for a resource, from the resource bundle if there is one and it has the image,
+    /// otherwise by decoding the PNG file from the resource path
+    /// @param aResourceName name relative to the resource path, e.g. "images/main.png"
+    /// @param aImage will be set to the decoded image
+    /// @return ok or error
+    ErrorPtr getResourceImage(const string aResourceName, DecodedImagePtr &aImage);
+
+    /// register that a view starts/stops showing an image
+    /// @param aImage the image
+    /// @param aInUse true when a view starts showing the image, false when it stops
+    /// @note images not used by any view can be evicted
+    void useImage(DecodedImagePtr aImage, bool aInUse);
+
+    /// @return number of bytes of all decoded images in the cache
+    size_t getBytesCached() { return bytesCached; };
+
+    /// @return number of bytes of images currently shown by views
+    size_t getBytesInUse();
+
+    /// @return cache statistics as JSON object
+    JsonObjectPtr json();
+
+  private:
+
+    /// evict unused images, least recently used first, until within budget
+    void trim();
+
+    /// look up a cached image
+    /// @return image, NULL if not cached or file has changed since
+    DecodedImagePtr cachedImage(const string aFileName, const FileVersion &aVersion);
+
+    /// add a decoded image to the cache (replacing a previous version, if any)
+    void addImage(const string aFileName, const FileVersion &aVersion, DecodedImagePtr aImage);
+
+    /// @return cache key for an image file at a given max size
+    static string cacheKey(const string aFileName, int aMaxSizeX, int aMaxSizeY);
+
+    void loaderThreadRoutine(ImageLoader *aLoader);
+    void loaderThreadSignal(ImageLoaderPtr aLoader, ThreadSignals aSignalCode);
+
+  };
+
+} // namespace p44
+
+
+#endif /* __pixelboardd_imagecache_hpp__ */
@@ -27,26 +27,40 @@ using namespace p44;
 
 
 ImageView::ImageView() :
-  pngBuffer(NULL)
+  loadSerial(0),
+  fitToFrame(false)
 {
 }
 
 
 ImageView::~ImageView()
 {
+  // image is shared, just tell the cache we no longer use it
+  ImageCache::sharedImageCache().useImage(image, false);
 }
 
 
 void ImageView::clear()
 {
   inherited::clear();
-  // init libpng image structure
-  memset(&pngImage, 0, (sizeof pngImage));
-  pngImage.version = PNG_IMAGE_VERSION;
-  // free the buffer if allocated
-  if (pngBuffer) {
-    free(pngBuffer);
-    pngBuffer = NULL;
+  setImage(DecodedImagePtr());
+}
+
+
+void ImageView::getMaxImageSize(int &aMaxSizeX, int &aMaxSizeY)
+{
+  aMaxSizeX = 0;
+  aMaxSizeY = 0;
+  if (fitToFrame) {
+    PixelRect f = getFrame();
+    if (contentOrientation & xy_swap) {
+      aMaxSizeX = f.dy;
+      aMaxSizeY = f.dx;
+    }
+    else {
+      aMaxSizeX = f.dx;
+      aMaxSizeY = f.dy;
+    }
   }
 }
 
@@ -55,61 +69,112 @@ ErrorPtr ImageView::loadPNG(const string aPNGFileName)
 {
   // clear any previous pattern (and make dirty)
   clear();
-  // read image
-  if (png_image_begin_read_from_file(&pngImage, aPNGFileName.c_str()) == 0) {
-    // error
-    return TextError::err("could not open PNG file %s", aPNGFileName.c_str());
+  DecodedImagePtr img;
+  int mx, my;
+  getMaxImageSize(mx, my);
+  ErrorPtr err = ImageCache::sharedImageCache().getImage(aPNGFileName, img, mx, my);
+  if (!Error::isOK(err)) return err;
+  setImage(img);
+  return ErrorPtr();
+}
+
+
+ErrorPtr ImageView::loadResourcePNG(const string aResourceName)
+{
+  clear();
+  DecodedImagePtr img;
+  ErrorPtr err = ImageCache::sharedImageCache().getResourceImage(aResourceName, img);
+  if (!Error::isOK(err)) return err;
+  setImage(img);
+  return ErrorPtr();
+}
+
+
+void ImageView::loadPNGInBackground(const string aPNGFileName, StatusCB aDoneCB, bool aCache)
+{
+  int mx, my;
+  getMaxImageSize(mx, my);
+  ImageCache::sharedImageCache().loadImageInBackground(
+    aPNGFileName,
+    boost::bind(&ImageView::backgroundLoaded, ImageViewPtr(this), ++loadSerial, aDoneCB, _1, _2),
+    mx, my,
+    aCache
+  );
+}
+
+
+void ImageView::backgroundLoaded(long aLoadSerial, StatusCB aDoneCB, ErrorPtr aError, DecodedImagePtr aImage)
+{
+  if (Error::isOK(aError) && aLoadSerial==loadSerial) {
+    setImage(aImage);
   }
-  else {
-    // We only need the luminance
-    pngImage.format = PNG_FORMAT_RGBA;
-    // Now allocate enough memory to hold the image in this format; the
-    // PNG_IMAGE_SIZE macro uses the information about the image (width,
-    // height and format) stored in 'image'.
-    pngBuffer = (png_bytep)malloc(PNG_IMAGE_SIZE(pngImage));
-    LOG(LOG_INFO, "Image size in bytes = %d", PNG_IMAGE_SIZE(pngImage));
-    LOG(LOG_INFO, "Image width = %d", pngImage.width);
-    LOG(LOG_INFO, "Image height = %d", pngImage.height);
-    LOG(LOG_INFO, "Image width*height = %d", pngImage.height*pngImage.width);
-    contentSizeX = pngImage.width;
-    contentSizeY = pngImage.height;
-    if (pngBuffer==NULL) {
-      return TextError::err("Could not allocate buffer for reading PNG file %s", aPNGFileName.c_str());
+  if (aDoneCB) aDoneCB(aError);
+}
+
+
+void ImageView::setImage(DecodedImagePtr aImage)
+{
+  loadSerial++; // pending background loads are outdated now
+  if (aImage==image) return;
+  ImageCache::sharedImageCache().useImage(aImage, true);
+  ImageCache::sharedImageCache().useImage(image, false);
+  image = aImage;
+  if (image) setContentSize(image->getSizeX(), image->getSizeY());
+  else setContentSize(0, 0);
+}
+
+
+ViewPtr ImageView::snapshot()
+{
+  ImageViewPtr s = ImageViewPtr(new ImageView);
+  s->copyViewState(*this);
+  s->fitToFrame = fitToFrame;
+  ImageCache::sharedImageCache().useImage(image, true); // released by the snapshot's destructor
+  s->image = image;
+  return s;
+}
+
+
+PixelRect ImageView::getOpaqueRect()
+{
+  if (alpha==255 && image) {
+    if (image->isBinaryAlpha() && backgroundColor.a==255) {
+      // transparent pixels show the opaque background
+      return getFrame();
     }
-    // now actually read the image
-    if (png_image_finish_read(
-      &pngImage,
-      NULL, // background
-      pngBuffer,
-      0, // row_stride
-      NULL //colormap
-    ) == 0) {
-      // error
-      ErrorPtr err = TextError::err("Error reading PNG file %s: error: %s", aPNGFileName.c_str(), pngImage.message);
-      clear(); // clear only after pngImage.message has been used
-      return err;
+    if (image->isOpaque()) {
+      // image area is opaque
+      PixelRect r = { .x=0, .y=0, .dx=contentSizeX, .dy=contentSizeY };
+      r = contentToFrameRect(r);
+      rectIntersect(r, getFrame());
+      return r;
     }
   }
-  // image read ok
-  makeDirty();
-  return ErrorPtr();
+  return zeroRect;
 }
 
 
 PixelColor ImageView::contentColorAt(int aX, int aY)
 {
-  if (aX<0 || aX>=contentSizeX || aY<0 || aY>=contentSizeY) {
+  if (!image || aX<0 || aX>=contentSizeX || aY<0 || aY>=contentSizeY) {
     return inherited::contentColorAt(aX, aY);
   }
   else {
-    PixelColor pc;
-    // get pixel infomration from image buffer
-    uint8_t *pix = pngBuffer+((pngImage.height-1-aY)*pngImage.width+aX)*4;
-    pc.r = *pix++;
-    pc.g = *pix++;
-    pc.b = *pix++;
-    pc.a = *pix++;
-    return pc;
+    return image->pixelAt(aX, aY);
   }
 }
 
+
+void ImageView::contentSpan(int aX, int aY, int aDx, int aDy, int aNum, PixelColor *aOut)
+{
+  for (int i=0; i<aNum; i++) {
+    if (!image || aX<0 || aX>=contentSizeX || aY<0 || aY>=contentSizeY) {
+      aOut[i] = backgroundColor;
+    }
+    else {
+      aOut[i] = image->pixelAt(aX, aY);
+    }
+    aX += aDx;
+    aY += aDy;
+  }
+}
@@ -25,8 +25,7 @@
 #include "p44utils_common.hpp"
 
 #include "view.hpp"
-
-#include <png.h>
+#include "imagecache.hpp"
 
 namespace p44 {
 
@@ -34,8 +33,9 @@ namespace p44 {
   {
     typedef View inherited;
 
-    png_image pngImage; /// The control structure used by libpng
-    png_bytep pngBuffer; /// byte buffer
+    DecodedImagePtr image; ///< the image shown, shared with other views showing the same image
+    long loadSerial; ///< incremented whenever the image changes, to discard outdated background loads
+    bool fitToFrame; ///< if set, images larger than the frame are downscaled when loading
 
   public :
 
@@ -46,14 +46,53 @@ namespace p44 {
     /// clear image
     void clear();
 
+    /// enable downscaling of images that are larger than the view's frame
+    /// @param aFitToFrame if set, images loaded later are downscaled (keeping aspect ratio) to fit the frame
+    /// @note set the frame before loading images
+    void setFitToFrame(bool aFitToFrame) { fitToFrame = aFitToFrame; };
+
     /// load PNG image
+    /// @note decoded images are shared via the ImageCache, so loading the same file again is cheap
     ErrorPtr loadPNG(const string aPNGFileName);
 
+    /// load PNG image in background, current image remains visible until the new one is ready
+    /// @param aPNGFileName the PNG file. It must not be removed before aDoneCB is called.
+    /// @param aDoneCB called when the new image is shown, or could not be loaded
+    /// @param aCache if not set, the image is not kept in the image cache (for temporary files)
+    /// @note if the view's image is changed otherwise before decoding completes, the loaded image is not shown
+    void loadPNGInBackground(const string aPNGFileName, StatusCB aDoneCB, bool aCache = true);
+
+    /// load image resource
+    /// @param aResourceName name relative to the resource path, e.g. "images/main.png"
+    /// @note the image is taken from the resource bundle when available, from the PNG file otherwise
+    ErrorPtr loadResourcePNG(const string aResourceName);
+
+    /// show an already decoded image
+    /// @param aImage the image, NULL to show none
+    void setImage(DecodedImagePtr aImage);
+
+    /// @return the image shown, NULL if none
+    DecodedImagePtr getImage() { return image; };
+
+    /// get the area where the image is known to be fully opaque
+    virtual PixelRect getOpaqueRect() P44_OVERRIDE;
+
+    /// create a frozen copy of this view, sharing the (immutable) image
+    virtual ViewPtr snapshot() P44_OVERRIDE;
+
   protected:
 
     /// get content color at X,Y
     virtual PixelColor contentColorAt(int aX, int aY);
 
+    /// get a run of content pixel colors directly from the image buffer
+    virtual void contentSpan(int aX, int aY, int aDx, int aDy, int aNum, PixelColor *aOut);
+
+  private:
+
+    void getMaxImageSize(int &aMaxSizeX, int &aMaxSizeY);
+    void backgroundLoaded(long aLoadSerial, StatusCB aDoneCB, ErrorPtr aError, DecodedImagePtr aImage);
+
   };
   typedef boost::intrusive_ptr<ImageView> ImageViewPtr;
 
@@ -0,0 +1,350 @@
+//
+//  Copyright (c) 2017 plan44.ch / Lukas Zeller, Zurich, Switzerland
+//
+//  Author: Lukas Zeller <luz@plan44.ch>
+//
+//  This file is part of pixelboardd.
+//
+//  pixelboardd is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  pixelboardd is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with pixelboardd. If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#include "ledoutput.hpp"
+
+using namespace p44;
+
+// MARK: ===== LEDOutput
+
+LEDOutput::LEDOutput(int aNumCols, int aNumRows) :
+  numCols(aNumCols),
+  numRows(aNumRows),
+  backSlot(0),
+  middleSlot(1),
+  frontSlot(2),
+  submittedValid(false),
+  shardGeneration(0),
+  shardsEncoded(0),
+  shardsLatched(0),
+  shardsTerminating(false),
+  terminating(false),
+  transmitting(false),
+  framesSent(0),
+  framesSkipped(0),
+  framesOverrun(0),
+  framesDropped(0)
+{
+  for (int i=0; i<3; i++) {
+    slots[i].resize(numCols*numRows, black);
+  }
+  submitted.resize(numCols*numRows, black);
+}
+
+
+LEDOutput::~LEDOutput()
+{
+  stopThread();
+}
+
+
+ErrorPtr LEDOutput::addChain(
+  LEDChainComm::LedType aLedType, const string aDeviceName, PixelRect aRegion,
+  int aLedsPerRow, bool aXReversed, bool aAlternating, bool aXYSwap, bool aYReversed
+) {
+  PixelRect board = { .x=0, .y=0, .dx=numCols, .dy=numRows };
+  PixelRect r = aRegion;
+  rectIntersect(r, board);
+  if (rectEmpty(aRegion) || r.x!=aRegion.x || r.y!=aRegion.y || r.dx!=aRegion.dx || r.dy!=aRegion.dy) {
+    return TextError::err("LED chain region %d,%d,%d,%d is not within the %dx%d board", aRegion.x, aRegion.y, aRegion.dx, aRegion.dy, numCols, numRows);
+  }
+  int numLeds = aRegion.dx*aRegion.dy;
+  if (aLedsPerRow<1 || aLedsPerRow>numLeds) {
+    return TextError::err("LED chain %s: invalid number of LEDs per row (%d)", aDeviceName.c_str(), aLedsPerRow);
+  }
+  LEDShard shard;
+  shard.chain = LEDChainCommPtr(new LEDChainComm(aLedType, aDeviceName, numLeds, aLedsPerRow, aXReversed, aAlternating, aXYSwap, aYReversed));
+  shard.region = aRegion;
+  // map LEDs in wire order to frame pixels, the same way as LEDChainComm::setColorXY() does
+  shard.frameIndex.resize(numLeds, -1);
+  int chainRows = numLeds/aLedsPerRow;
+  for (int y=0; y<aRegion.dy; y++) {
+    for (int x=0; x<aRegion.dx; x++) {
+      int cx = aXYSwap ? y : x;
+      int cy = aXYSwap ? x : y;
+      if (aYReversed) cy = chainRows-1-cy;
+      bool reversed = aXReversed!=(aAlternating && (cy & 1));
+      if (cx<0 || cx>=aLedsPerRow || cy<0 || cy>=chainRows) continue; // not on chain
+      int ledIndex = cy*aLedsPerRow + (reversed ? aLedsPerRow-1-cx : cx);
+      shard.frameIndex[ledIndex] = (aRegion.y+y)*numCols+aRegion.x+x;
+    }
+  }
+  shard.shown.resize(numLeds, black);
+  shard.shownValid = false;
+  shards.push_back(shard);
+  return ErrorPtr();
+}
+
+
+ErrorPtr LEDOutput::addChainsFromMap(JsonObjectPtr aMap)
+{
+  JsonObjectPtr chains;
+  if (!aMap || !aMap->get("chains", chains) || chains->arrayLength()<1) {
+    return TextError::err("LED chain map must have a non-empty 'chains' array");
+  }
+  for (int i=0; i<chains->arrayLength(); i++) {
+    JsonObjectPtr c = chains->arrayGet(i);
+    JsonObjectPtr o;
+    string device;
+    if (c->get("device", o)) device = o->stringValue();
+    else return TextError::err("LED chain #%d has no 'device'", i);
+    PixelRect r = zeroRect;
+    if (c->get("x", o)) r.x = o->int32Value();
+    if (c->get("y", o)) r.y = o->int32Value();
+    if (c->get("dx", o)) r.dx = o->int32Value();
+    if (c->get("dy", o)) r.dy = o->int32Value();
+    // defaults are the wiring of the original board: LEDs running up and down the columns
+    LEDChainComm::LedType ledType = LEDChainComm::ledtype_ws281x;
+    if (c->get("type", o)) {
+      string t = o->stringValue();
+      if (t=="sk6812") ledType = LEDChainComm::ledtype_sk6812;
+      else if (t=="p9823") ledType = LEDChainComm::ledtype_p9823;
+      else if (t!="ws281x") return TextError::err("LED chain #%d has unknown type '%s'", i, t.c_str());
+    }
+    bool xReversed = false;
+    bool alternating = true;
+    bool xySwap = true;
+    bool yReversed = true;
+    if (c->get("xreversed", o)) xReversed = o->boolValue();
+    if (c->get("alternating", o)) alternating = o->boolValue();
+    if (c->get("xyswap", o)) xySwap = o->boolValue();
+    if (c->get("yreversed", o)) yReversed = o->boolValue();
+    int ledsPerRow = xySwap ? r.dy : r.dx;
+    if (c->get("ledsperrow", o)) ledsPerRow = o->int32Value();
+    ErrorPtr err = addChain(ledType, device, r, ledsPerRow, xReversed, alternating, xySwap, yReversed);
+    if (!Error::isOK(err)) return err;
+  }
+  return ErrorPtr();
+}
+
+
+void LEDOutput::begin()
+{
+  for (size_t i=0; i<shards.size(); i++) {
+    shards[i].chain->begin();
+    shards[i].chain->show();
+  }
+  if (shards.size()>1) {
+    // each chain transmits from its own thread
+    shardsTerminating = false;
+    for (size_t i=0; i<shards.size(); i++) {
+      if (shards[i].thread) continue; // already running
+      shards[i].thread = MainLoop::currentMainLoop().executeInThread(
+        boost::bind(&LEDOutput::shardThreadRoutine, this, _1, i),
+        boost::bind(&LEDOutput::outputThreadSignal, this, _1, _2)
+      );
+    }
+  }
+}
+
+
+void LEDOutput::startThread()
+{
+  if (outputThread) return; // already running
+  terminating = false;
+  outputThread = MainLoop::currentMainLoop().executeInThread(
+    boost::bind(&LEDOutput::outputThreadRoutine, this, _1),
+    boost::bind(&LEDOutput::outputThreadSignal, this, _1, _2)
+  );
+}
+
+
+void LEDOutput::stopThread()
+{
+  if (outputThread) {
+    {
+      std::lock_guard<std::mutex> lock(wakeMutex);
+      terminating = true;
+    }
+    wakeCond.notify_one();
+    outputThread->terminate();
+    outputThread.reset();
+  }
+  // chain threads can only be stopped when no frame is being transmitted any more
+  {
+    std::lock_guard<std::mutex> lock(shardMutex);
+    shardsTerminating = true;
+  }
+  shardCond.notify_all();
+  for (size_t i=0; i<shards.size(); i++) {
+    if (shards[i].thread) {
+      shards[i].thread->terminate();
+      shards[i].thread.reset();
+    }
+  }
+}
+
+
+bool LEDOutput::submitFrame(const PixelColor *aFrame)
+{
+  size_t frameBytes = numCols*numRows*sizeof(PixelColor);
+  {
+    std::lock_guard<std::mutex> lock(submittedMutex);
+    if (submittedValid && memcmp(aFrame, &submitted[0], frameBytes)==0) {
+      // nothing has changed, no need to transmit anything
+      framesSkipped++;
+      return false;
+    }
+    memcpy(&submitted[0], aFrame, frameBytes);
+    submittedValid = true;
+  }
+  // fill back buffer and exchange it with the middle buffer
+  memcpy(&slots[backSlot][0], aFrame, frameBytes);
+  if (transmitting) {
+    // output is slower than frames come in
+    framesOverrun++;
+    LOG(LOG_DEBUG, "LED output overrun: new frame while previous frame is still being transmitted");
+  }
+  int prev = middleSlot.exchange(backSlot|newFrameFlag);
+  if (prev & newFrameFlag) {
+    framesDropped++; // the frame we got back was never transmitted
+  }
+  backSlot = prev & slotMask;
+  if (outputThread) {
+    // wake output thread
+    { std::lock_guard<std::mutex> lock(wakeMutex); }
+    wakeCond.notify_one();
+  }
+  else {
+    transmitPending();
+  }
+  return true;
+}
+
+
+PixelColor LEDOutput::colorAt(int aX, int aY)
+{
+  if (aX<0 || aX>=numCols || aY<0 || aY>=numRows) return black;
+  std::lock_guard<std::mutex> lock(submittedMutex);
+  return submitted[aY*numCols+aX];
+}
+
+
+void LEDOutput::transmitPending()
+{
+  if ((middleSlot.load() & newFrameFlag)==0) return; // no new frame
+  // take the most recent frame, leave our previous front buffer for the submitting side to fill
+  frontSlot = middleSlot.exchange(frontSlot) & slotMask;
+  framesSent++;
+  if (shards.empty()) return; // no LEDs (simulation)
+  transmitting = true;
+  MLMicroSeconds start = MainLoop::now();
+  if (shards[0].thread) {
+    // let the chain threads transmit the frame, and wait until all of them are done
+    // (front buffer must not change while they are reading it)
+    std::unique_lock<std::mutex> lock(shardMutex);
+    shardsEncoded = 0;
+    shardsLatched = 0;
+    shardGeneration++;
+    shardCond.notify_all();
+    while (!shardsTerminating && shardsLatched<shards.size()) {
+      shardCond.wait(lock);
+    }
+  }
+  else {
+    // transmit chain by chain
+    const PixelColor *frame = &slots[frontSlot][0];
+    for (size_t i=0; i<shards.size(); i++) {
+      encodeShard(shards[i], frame);
+    }
+    for (size_t i=0; i<shards.size(); i++) {
+      shards[i].chain->show();
+    }
+  }
+  showTimes.add(MainLoop::now()-start);
+  transmitting = false;
+}
+
+
+void LEDOutput::encodeShard(LEDShard &aShard, const PixelColor *aFrame)
+{
+  // walk the chain in wire order, only update LEDs that have changed
+  int numLeds = (int)aShard.frameIndex.size();
+  const int *fi = &aShard.frameIndex[0];
+  PixelColor *shown = &aShard.shown[0];
+  for (int i=0; i<numLeds; i++) {
+    if (fi[i]<0) continue; // unused LED
+    const PixelColor &p = aFrame[fi[i]];
+    if (!aShard.shownValid || p.r!=shown[i].r || p.g!=shown[i].g || p.b!=shown[i].b) {
+      aShard.chain->setColor(i, p.r, p.g, p.b);
+      shown[i] = p;
+    }
+  }
+  aShard.shownValid = true;
+}
+
+
+void LEDOutput::outputThreadRoutine(ChildThreadWrapper &aThread)
+{
+  while (true) {
+    {
+      std::unique_lock<std::mutex> lock(wakeMutex);
+      while (!terminating && (middleSlot.load() & newFrameFlag)==0) {
+        wakeCond.wait(lock);
+      }
+      if (terminating) break;
+    }
+    transmitPending();
+  }
+}
+
+
+void LEDOutput::shardThreadRoutine(ChildThreadWrapper &aThread, size_t aShardIndex)
+{
+  LEDShard &shard = shards[aShardIndex];
+  long generation = 0;
+  while (true) {
+    {
+      std::unique_lock<std::mutex> lock(shardMutex);
+      while (!shardsTerminating && shardGeneration==generation) {
+        shardCond.wait(lock);
+      }
+      if (shardsTerminating) break;
+      generation = shardGeneration;
+    }
+    encodeShard(shard, &slots[frontSlot][0]);
+    {
+      // barrier: only latch when all chains have the frame ready, so all show it at the same time
+      std::unique_lock<std::mutex> lock(shardMutex);
+      if (++shardsEncoded==shards.size()) {
+        shardCond.notify_all();
+      }
+      while (!shardsTerminating && shardsEncoded<shards.size()) {
+        shardCond.wait(lock);
+      }
+      if (shardsTerminating) break;
+    }
+    shard.chain->show();
+    {
+      std::lock_guard<std::mutex> lock(shardMutex);
+      if (++shardsLatched==shards.size()) {
+        shardCond.notify_all();
+      }
+    }
+  }
+}
+
+
+void LEDOutput::outputThreadSignal(ChildThreadWrapper &aChildThread, ThreadSignals aSignalCode)
+{
+  LOG(LOG_INFO, "LED output thread signals %d", aSignalCode);
+}
@@ -0,0 +1,194 @@
+//
+//  Copyright (c) 2017 plan44.ch / Lukas Zeller, Zurich, Switzerland
+//
+//  Author: Lukas Zeller <luz@plan44.ch>
+//
+//  This file is part of pixelboardd.
+//
+//  pixelboardd is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  pixelboardd is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with pixelboardd. If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#ifndef __pixelboardd_ledoutput_hpp__
+#define __pixelboardd_ledoutput_hpp__
+
+#include "p44utils_common.hpp"
+#include "ledchaincomm.hpp"
+#include "view.hpp"
+#include "stats.hpp"
+#include "jsonobject.hpp"
+
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+
+namespace p44 {
+
+  /// one LED chain showing a rectangular region of the board
+  class LEDShard
+  {
+    friend class LEDOutput;
+
+    LEDChainCommPtr chain; ///< the LED chain
+    PixelRect region; ///< the region of the board shown on this chain
+    std::vector<int> frameIndex; ///< for each LED in wire order, index of its pixel in the frame, -1 for unused LEDs
+    std::vector<PixelColor> shown; ///< what the LEDs of this chain currently show, in wire order
+    bool shownValid; ///< set when shown reflects the LED state
+    ChildThreadWrapperPtr thread; ///< the transmit thread for this chain, NULL if transmitted by the output side directly
+  };
+
+
+  /// Delivers composited frames to one or multiple LED chains, optionally from a separate output thread.
+  /// Frames are passed from the submitting side (main loop or render thread, see FrameRenderer) to the
+  /// output side through a lock-free triple buffer, so neither side ever waits for the other: the
+  /// submitting side always has a free back buffer to fill, and the output side always transmits
+  /// the most recent complete frame.
+  /// With multiple chains, each chain is transmitted from its own thread. All chains latch
+  /// the same frame at the same time, so output time is that of the longest chain.
+  class LEDOutput : public P44Obj
+  {
+    std::vector<LEDShard> shards; ///< the LED chains to output to
+    int numCols; ///< number of columns in a frame
+    int numRows; ///< number of rows in a frame
+
+    // triple buffer
+    enum {
+      slotMask = 0x03, ///< mask for the slot index
+      newFrameFlag = 0x04 ///< set in middleSlot when it contains a frame not yet taken by the output side
+    };
+    std::vector<PixelColor> slots[3]; ///< the three frame buffers
+    int backSlot; ///< slot owned by the submitting side, being filled
+    std::atomic<int> middleSlot; ///< slot exchanged between both sides, plus newFrameFlag
+    int frontSlot; ///< slot owned by the output side, being transmitted
+
+    // submitting side
+    std::vector<PixelColor> submitted; ///< last submitted frame (to detect unchanged frames)
+    bool submittedValid; ///< set when submitted contains a frame
+    std::mutex submittedMutex; ///< protects submitted, which the render thread writes while API requests read it
+
+    // chain transmit threads
+    std::mutex shardMutex; ///< protects the counters below
+    std::condition_variable shardCond; ///< signalled when the counters below change
+    long shardGeneration; ///< incremented for every frame to be transmitted by the chain threads
+    size_t shardsEncoded; ///< number of chains that have their data ready for the current frame
+    size_t shardsLatched; ///< number of chains that have transmitted the current frame
+    bool shardsTerminating; ///< set to make the chain threads terminate
+
+    // output thread
+    ChildThreadWrapperPtr outputThread; ///< the output thread, NULL if output is done from the main loop
+    std::mutex wakeMutex; ///< only used to sleep/wake the output thread, not to protect frame data
+    std::condition_variable wakeCond; ///< signalled when a new frame is available or thread must terminate
+    bool terminating; ///< set to make the output thread terminate
+    std::atomic<bool> transmitting; ///< set while the output side is transmitting a frame
+
+    // statistics
+    std::atomic<long> framesSent; ///< number of frames transmitted to the LED chain
+    long framesSkipped; ///< number of submitted frames not transmitted because nothing has changed
+    long framesOverrun; ///< number of frames submitted while the previous frame was still being transmitted
+    long framesDropped; ///< number of frames replaced by a newer frame before they could be transmitted
+    LatencyHistogram showTimes; ///< time needed to transmit a frame to the LED chain
+
+  public :
+
+    /// create LED output
+    /// @param aNumCols number of columns of the frames to output
+    /// @param aNumRows number of rows of the frames to output
+    /// @note without any chains added, frames are discarded (e.g. for simulation)
+    LEDOutput(int aNumCols, int aNumRows);
+
+    virtual ~LEDOutput();
+
+    /// add a LED chain
+    /// @param aLedType type of LEDs
+    /// @param aDeviceName the LED chain device
+    /// @param aRegion the region of the board to show on this chain. Chain X,Y coordinates are relative to this region.
+    /// @param aLedsPerRow number of consecutive LEDs in one row of the chain
+    /// @param aXReversed X direction is reversed
+    /// @param aAlternating X direction is reversed in every other row
+    /// @param aXYSwap X and Y are swapped (chain rows are region columns)
+    /// @param aYReversed Y direction is reversed
+    /// @return ok or error if region is not within the board
+    /// @note the mapping from board pixels to LEDs is computed once here, and not per pixel when transmitting
+    ErrorPtr addChain(
+      LEDChainComm::LedType aLedType, const string aDeviceName, PixelRect aRegion,
+      int aLedsPerRow, bool aXReversed, bool aAlternating, bool aXYSwap, bool aYReversed
+    );
+
+    /// add LED chains as described by a mapping config
+    /// @param aMap JSON object with a "chains" array. Each element describes a chain with
+    ///   "device", the board region "x","y","dx","dy", and optionally "type" (ws281x, sk6812, p9823),
+    ///   "ledsperrow", "xreversed", "alternating", "xyswap" and "yreversed" (see LEDChainComm).
+    /// @return ok or error if mapping is invalid
+    ErrorPtr addChainsFromMap(JsonObjectPtr aMap);
+
+    /// @return number of LED chains
+    size_t getNumChains() { return shards.size(); };
+
+    /// start operating the LED chains
+    /// @note with more than one chain, this starts a transmit thread per chain
+    void begin();
+
+    /// start output thread
+    /// @note without output thread, frames are transmitted synchronously from submitFrame()
+    void startThread();
+
+    /// stop output thread and chain transmit threads (if any), further frames will be transmitted from the main loop
+    void stopThread();
+
+    /// submit a new frame for output
+    /// @param aFrame numCols*numRows pixels, row by row. Only r,g,b are used.
+    /// @return true if frame has changed and will be transmitted, false if it was identical to the previous frame
+    bool submitFrame(const PixelColor *aFrame);
+
+    /// @return color of a pixel in the last submitted frame
+    /// @param aX column
+    /// @param aY row
+    PixelColor colorAt(int aX, int aY);
+
+    /// @return number of frames transmitted to the LED chain
+    long getFramesSent() { return framesSent; };
+
+    /// @return number of frames not transmitted because nothing has changed
+    long getFramesSkipped() { return framesSkipped; };
+
+    /// @return number of frames submitted while the previous frame was still being transmitted
+    long getFramesOverrun() { return framesOverrun; };
+
+    /// @return number of frames never transmitted because a newer frame replaced them
+    long getFramesDropped() { return framesDropped; };
+
+    /// @return histogram of the time needed to transmit frames to the LED chain
+    LatencyHistogram &getShowTimes() { return showTimes; };
+
+  private:
+
+    /// transmit the most recent frame, if there is a new one
+    /// @note this is called from the output thread, or from the submitting side when there is no output thread
+    void transmitPending();
+
+    /// update changed LEDs of a chain from a frame, without transmitting yet
+    void encodeShard(LEDShard &aShard, const PixelColor *aFrame);
+
+    void outputThreadRoutine(ChildThreadWrapper &aThread);
+    void outputThreadSignal(ChildThreadWrapper &aChildThread, ThreadSignals aSignalCode);
+    void shardThreadRoutine(ChildThreadWrapper &aThread, size_t aShardIndex);
+
+  };
+  typedef boost::intrusive_ptr<LEDOutput> LEDOutputPtr;
+
+} // namespace p44
+
+
+
+#endif /* __pixelboardd_ledoutput_hpp__ */
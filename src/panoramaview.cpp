@@ -0,0 +1,257 @@
+//
+//  Copyright (c) 2017 plan44.ch / Lukas Zeller, Zurich, Switzerland
+//
+//  Author: Lukas Zeller <luz@plan44.ch>
+//
+//  This file is part of pixelboardd.
+//
+//  pixelboardd is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  pixelboardd is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with pixelboardd. If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#include "panoramaview.hpp"
+
+using namespace p44;
+
+#define PANORAMA_SUBPIXEL_BITS 8 // position resolution, matches the 8 bit interpolation weights
+#define PANORAMA_SUBPIXELS (1<<PANORAMA_SUBPIXEL_BITS)
+
+
+/// interpolate between two premultiplied pixels
+/// @param aWeightB weight of aB in 1/PANORAMA_SUBPIXELS, weight of aA is the rest
+static inline PixelColor interpolatePixel(const PixelColor &aA, const PixelColor &aB, int aWeightB)
+{
+  int wa = PANORAMA_SUBPIXELS-aWeightB;
+  PixelColor p;
+  p.r = (aA.r*wa+aB.r*aWeightB)>>PANORAMA_SUBPIXEL_BITS;
+  p.g = (aA.g*wa+aB.g*aWeightB)>>PANORAMA_SUBPIXEL_BITS;
+  p.b = (aA.b*wa+aB.b*aWeightB)>>PANORAMA_SUBPIXEL_BITS;
+  p.a = (aA.a*wa+aB.a*aWeightB)>>PANORAMA_SUBPIXEL_BITS;
+  return p;
+}
+
+
+// MARK: ===== PanoramaView
+
+PanoramaView::PanoramaView() :
+  looping(true),
+  velocity(0),
+  startPos(0),
+  startTime(Never),
+  pos(0)
+{
+}
+
+
+PanoramaView::~PanoramaView()
+{
+  // image is shared, just tell the cache we no longer use it
+  ImageCache::sharedImageCache().useImage(image, false);
+}
+
+
+void PanoramaView::clear()
+{
+  inherited::clear();
+  velocity = 0;
+  pos = 0;
+  setImage(DecodedImagePtr());
+}
+
+
+ErrorPtr PanoramaView::loadPNG(const string aPNGFileName)
+{
+  DecodedImagePtr img;
+  ErrorPtr err = ImageCache::sharedImageCache().getImage(aPNGFileName, img);
+  if (!Error::isOK(err)) return err;
+  setImage(img);
+  return ErrorPtr();
+}
+
+
+void PanoramaView::setImage(DecodedImagePtr aImage)
+{
+  if (aImage!=image) {
+    ImageCache::sharedImageCache().useImage(aImage, true);
+    ImageCache::sharedImageCache().useImage(image, false);
+    image = aImage;
+  }
+  if (image) {
+    // content is the visible window onto the image
+    setContentSize(contentOrientation & xy_swap ? dY : dX, image->getSizeY());
+  }
+  else {
+    setContentSize(0, 0);
+  }
+  pos = wrapPosition(pos);
+  rebase();
+}
+
+
+int64_t PanoramaView::wrapPosition(int64_t aPos)
+{
+  if (!image) return 0;
+  if (looping) {
+    int64_t w = (int64_t)image->getSizeX()<<PANORAMA_SUBPIXEL_BITS;
+    aPos %= w;
+    if (aPos<0) aPos += w;
+  }
+  else {
+    int64_t maxPos = (int64_t)max(image->getSizeX()-contentSizeX, 0)<<PANORAMA_SUBPIXEL_BITS;
+    if (aPos<0) aPos = 0;
+    else if (aPos>maxPos) aPos = maxPos;
+  }
+  return aPos;
+}
+
+
+void PanoramaView::rebase()
+{
+  startPos = pos;
+  startTime = BoardClock::now();
+}
+
+
+void PanoramaView::setVelocity(double aPixelsPerSecond)
+{
+  updatePosition();
+  rebase();
+  velocity = (int64_t)(aPixelsPerSecond*PANORAMA_SUBPIXELS);
+  if (velocity!=0) requestStep();
+}
+
+
+double PanoramaView::getVelocity()
+{
+  return (double)velocity/PANORAMA_SUBPIXELS;
+}
+
+
+void PanoramaView::setPosition(double aX)
+{
+  pos = wrapPosition((int64_t)(aX*PANORAMA_SUBPIXELS));
+  rebase();
+  makeDirty();
+}
+
+
+double PanoramaView::getPosition()
+{
+  return (double)pos/PANORAMA_SUBPIXELS;
+}
+
+
+void PanoramaView::updatePosition()
+{
+  if (velocity==0 || !image) return;
+  // position is calculated from the time elapsed, so it does not depend on how often step() is called
+  int64_t unwrapped = startPos+velocity*(BoardClock::now()-startTime)/Second;
+  int64_t p = wrapPosition(unwrapped);
+  if (!looping && p!=unwrapped) {
+    // reached the end of the image
+    velocity = 0;
+  }
+  if (p!=pos) {
+    pos = p;
+    makeDirty();
+  }
+}
+
+
+bool PanoramaView::step()
+{
+  bool complete = inherited::step();
+  updatePosition();
+  return complete;
+}
+
+
+MLMicroSeconds PanoramaView::nextStepTime()
+{
+  MLMicroSeconds next = inherited::nextStepTime();
+  if (velocity!=0 && image) {
+    // time when the position will have moved by one more sub-pixel
+    int64_t absv = velocity<0 ? -velocity : velocity;
+    int64_t moved = absv*(BoardClock::now()-startTime)/Second;
+    MLMicroSeconds t = startTime+((moved+1)*Second+absv-1)/absv;
+    if (t<next) next = t;
+  }
+  return next;
+}
+
+
+bool PanoramaView::isAnimating()
+{
+  return inherited::isAnimating() || (velocity!=0 && image);
+}
+
+
+ViewPtr PanoramaView::snapshot()
+{
+  PanoramaViewPtr s = PanoramaViewPtr(new PanoramaView);
+  s->copyViewState(*this);
+  ImageCache::sharedImageCache().useImage(image, true); // released by the snapshot's destructor
+  s->image = image;
+  s->looping = looping;
+  s->velocity = velocity;
+  s->startPos = startPos;
+  s->startTime = startTime;
+  s->pos = pos;
+  return s;
+}
+
+
+PixelColor PanoramaView::columnPixel(int aX, int aY)
+{
+  int w = image->getSizeX();
+  if (looping) {
+    aX %= w;
+    if (aX<0) aX += w;
+  }
+  else if (aX<0 || aX>=w) {
+    return backgroundColor;
+  }
+  return image->pixelAt(aX, aY);
+}
+
+
+PixelColor PanoramaView::contentColorAt(int aX, int aY)
+{
+  PixelColor pc;
+  contentSpan(aX, aY, 1, 0, 1, &pc);
+  return pc;
+}
+
+
+void PanoramaView::contentSpan(int aX, int aY, int aDx, int aDy, int aNum, PixelColor *aOut)
+{
+  // only the image columns within the window are evaluated
+  int ipos = (int)(pos>>PANORAMA_SUBPIXEL_BITS);
+  int frac = (int)(pos & (PANORAMA_SUBPIXELS-1));
+  for (int i=0; i<aNum; i++) {
+    if (!image || aX<0 || aX>=contentSizeX || aY<0 || aY>=contentSizeY) {
+      aOut[i] = backgroundColor;
+    }
+    else if (frac==0) {
+      // exactly on a column
+      aOut[i] = columnPixel(ipos+aX, aY);
+    }
+    else {
+      // between two columns
+      aOut[i] = interpolatePixel(columnPixel(ipos+aX, aY), columnPixel(ipos+aX+1, aY), frac);
+    }
+    aX += aDx;
+    aY += aDy;
+  }
+}
@@ -0,0 +1,121 @@
+//
+//  Copyright (c) 2017 plan44.ch / Lukas Zeller, Zurich, Switzerland
+//
+//  Author: Lukas Zeller <luz@plan44.ch>
+//
+//  This file is part of pixelboardd.
+//
+//  pixelboardd is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  pixelboardd is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with pixelboardd. If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#ifndef __pixelboardd_panoramaview_hpp__
+#define __pixelboardd_panoramaview_hpp__
+
+#include "p44utils_common.hpp"
+
+#include "view.hpp"
+#include "imagecache.hpp"
+
+namespace p44 {
+
+  /// View scrolling an image wider than the view across it at a constant speed.
+  /// The scroll position has sub-pixel resolution, and pixels between two image columns are interpolated,
+  /// so slow scrolling moves smoothly instead of jumping from column to column.
+  /// Only the columns within the view are ever evaluated, so the image width does not affect rendering cost.
+  class PanoramaView : public View
+  {
+    typedef View inherited;
+
+    DecodedImagePtr image; ///< the panorama image, shared via the ImageCache
+    bool looping; ///< if set, the image repeats endlessly, otherwise scrolling stops at either end
+    int64_t velocity; ///< scroll speed in sub-pixels per second, positive moves the image to the left
+    int64_t startPos; ///< position at startTime, in sub-pixels
+    MLMicroSeconds startTime; ///< time of last velocity change
+    int64_t pos; ///< image X (in sub-pixels) shown at content X 0
+
+  public :
+
+    PanoramaView();
+
+    virtual ~PanoramaView();
+
+    /// clear image and stop scrolling
+    virtual void clear() P44_OVERRIDE;
+
+    /// load PNG image
+    /// @param aPNGFileName the image, usually much wider than the view
+    /// @note set frame and orientation before, content size is adjusted to the view's width and the image's height
+    ErrorPtr loadPNG(const string aPNGFileName);
+
+    /// show an already decoded image
+    /// @param aImage the image, NULL to show none
+    void setImage(DecodedImagePtr aImage);
+
+    /// set scroll speed
+    /// @param aPixelsPerSecond speed, positive values move the image to the left, 0 stops scrolling
+    void setVelocity(double aPixelsPerSecond);
+
+    /// @return scroll speed in pixels per second
+    double getVelocity();
+
+    /// set looping
+    /// @param aLooping if set, the image start follows its end seamlessly, otherwise scrolling stops at the ends
+    void setLooping(bool aLooping) { looping = aLooping; };
+
+    /// set scroll position
+    /// @param aX image X coordinate to show at the view's content X 0, can be fractional
+    void setPosition(double aX);
+
+    /// @return current scroll position
+    double getPosition();
+
+    /// calculate changes on the display, return true if any
+    /// @return true if complete, false if step() would like to be called immediately again
+    virtual bool step() P44_OVERRIDE;
+
+    /// get time when step() needs to be called next
+    /// @return time when the position advances by the next sub-pixel, or earlier if the view is fading
+    virtual MLMicroSeconds nextStepTime() P44_OVERRIDE;
+
+    /// return if view is currently animating
+    virtual bool isAnimating() P44_OVERRIDE;
+
+    /// create a frozen copy of this view at the current scroll position, sharing the image
+    virtual ViewPtr snapshot() P44_OVERRIDE;
+
+  protected:
+
+    /// get content color at X,Y
+    virtual PixelColor contentColorAt(int aX, int aY) P44_OVERRIDE;
+
+    /// get a run of content pixel colors, interpolated between the image columns at the current position
+    virtual void contentSpan(int aX, int aY, int aDx, int aDy, int aNum, PixelColor *aOut) P44_OVERRIDE;
+
+  private:
+
+    void rebase();
+    void updatePosition();
+    int64_t wrapPosition(int64_t aPos);
+    PixelColor columnPixel(int aX, int aY);
+
+  };
+  typedef boost::intrusive_ptr<PanoramaView> PanoramaViewPtr;
+
+
+} // namespace p44
+
+
+
+#endif /* __pixelboardd_panoramaview_hpp__ */
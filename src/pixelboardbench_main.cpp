@@ -0,0 +1,364 @@
+//
+//  Copyright (c) 2017 plan44.ch / Lukas Zeller, Zurich, Switzerland
+//
+//  Author: Lukas Zeller <luz@plan44.ch>
+//
+//  This file is part of pixelboardd.
+//
+//  pixelboardd is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  pixelboardd is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with pixelboardd. If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#include "application.hpp"
+
+// Pages
+#include "blocks.hpp"
+#include "display.hpp"
+#include "life.hpp"
+
+#include <new>
+
+using namespace p44;
+
+#define DEFAULT_LOGLEVEL LOG_WARNING
+#define DEFAULT_FRAMES 1000
+#define DEFAULT_WARMUP (2*Second)
+
+
+// MARK: ===== allocation counting
+
+static long numAllocations = 0;
+
+void *operator new(size_t aSize)
+{
+  numAllocations++;
+  void *p = malloc(aSize ? aSize : 1);
+  if (!p) throw std::bad_alloc();
+  return p;
+}
+
+void operator delete(void *aPtr) noexcept
+{
+  free(aPtr);
+}
+
+
+// MARK: ===== benchmark page
+
+/// page just showing a view, to benchmark standard view stacks the same way as real pages
+class BenchPage : public PixelPage
+{
+  typedef PixelPage inherited;
+
+public:
+
+  BenchPage(const string aName, PixelPageInfoCB aInfoCallback, ViewPtr aView, int aNumCols, int aNumRows) :
+    inherited(aName, aInfoCallback, aNumCols, aNumRows)
+  {
+    setView(aView);
+  }
+
+  virtual void show(PageMode aMode) P44_OVERRIDE {};
+  virtual void hide() P44_OVERRIDE {};
+
+};
+
+
+// MARK: ===== benchmark application
+
+/// one benchmark: a page rendered at a given size
+typedef struct {
+  PixelPagePtr page; ///< the page to render
+  PageMode mode; ///< mode to show the page in
+  int cols; ///< board width
+  int rows; ///< board height
+} BenchCase;
+
+
+class PixelBoardBench : public CmdLineApp
+{
+  typedef CmdLineApp inherited;
+
+  int numFrames;
+  int numCols;
+  int numRows;
+  MLMicroSeconds warmupTime;
+
+  // running benchmark
+  std::vector<BenchCase> cases;
+  size_t caseIndex; ///< current benchmark
+  bool caseStarted; ///< set when current benchmark's page is shown
+  MLMicroSeconds warmupEnd; ///< frames rendered before this time are not measured
+  int frameNo; ///< number of measured frames so far
+  std::vector<PixelColor> frame;
+  MLMicroSeconds stepTime;
+  MLMicroSeconds spanTime;
+  MLMicroSeconds colorAtTime;
+  long allocations;
+  MLTicket frameTicket;
+
+public:
+
+  PixelBoardBench() :
+    numFrames(DEFAULT_FRAMES),
+    numCols(DEFAULT_NUMCOLS),
+    numRows(DEFAULT_NUMROWS),
+    warmupTime(DEFAULT_WARMUP),
+    caseIndex(0),
+    caseStarted(false)
+  {
+  }
+
+  virtual int main(int argc, char **argv)
+  {
+    const char *usageText =
+      "Usage: %1$s [options]\n"
+      "Renders the pages and some standard view stacks without any LED or touch hardware\n";
+    const CmdLineOptionDescriptor options[] = {
+      { 'n', "frames",         true,  "frames;number of frames to measure per benchmark (default=1000)" },
+      { 0  , "warmup",         true,  "seconds;time to run each benchmark before measuring, lets page timers start games etc. (default=2)" },
+      { 0  , "cols",           true,  "cols;number of columns of the board (default=10)" },
+      { 0  , "rows",           true,  "rows;number of rows of the board (default=20)" },
+      { 0  , "image",          true,  "filename;PNG image to use as bottom layer in view stack benchmarks" },
+      { 'l', "loglevel",       true,  "level;set max level of log message detail to show on stdout" },
+      { 'r', "resourcepath",   true,  "path;path to the images and sounds folders" },
+      { 'd', "datapath",       true,  "path;path to the r/w persistent data" },
+      { 'h', "help",           false, "show this text" },
+      { 0, NULL } // list terminator
+    };
+
+    // parse the command line, exits when syntax errors occur
+    setCommandDescriptors(usageText, options);
+    parseCommandLine(argc, argv);
+
+    if (getOption("help") || numArguments()>0) {
+      // show usage
+      showUsage();
+      terminateApp(EXIT_SUCCESS);
+    }
+
+    if (!isTerminated()) {
+      int loglevel = DEFAULT_LOGLEVEL;
+      getIntOption("loglevel", loglevel);
+      SETLOGLEVEL(loglevel);
+      getIntOption("frames", numFrames);
+      getIntOption("cols", numCols);
+      getIntOption("rows", numRows);
+      int w;
+      if (getIntOption("warmup", w)) warmupTime = w*Second;
+    }
+    // app now ready to run (or cleanup when already terminated)
+    return run();
+  }
+
+
+  void pageInfoHandler(PixelPage &aPage, const string aInfo)
+  {
+    // pages are driven directly, no page switching
+  }
+
+
+  void addCase(PixelPagePtr aPage, PageMode aMode, int aCols, int aRows)
+  {
+    BenchCase c;
+    c.page = aPage;
+    c.mode = aMode;
+    c.cols = aCols;
+    c.rows = aRows;
+    cases.push_back(c);
+  }
+
+
+  /// render one frame of the current benchmark
+  /// @note frames are rendered from the mainloop, one per cycle, so page timers run as in pixelboardd
+  void benchFrame()
+  {
+    if (caseIndex>=cases.size()) {
+      // all done
+      terminateApp(EXIT_SUCCESS);
+      return;
+    }
+    BenchCase &c = cases[caseIndex];
+    if (!caseStarted) {
+      c.page->show(c.mode);
+      caseStarted = true;
+      warmupEnd = MainLoop::now()+warmupTime;
+      frameNo = 0;
+      frame.resize(c.cols*c.rows);
+      stepTime = 0;
+      spanTime = 0;
+      colorAtTime = 0;
+      allocations = 0;
+    }
+    bool measure = MainLoop::now()>=warmupEnd;
+    long a = numAllocations;
+    MLMicroSeconds t = MainLoop::now();
+    c.page->step();
+    MLMicroSeconds t2 = MainLoop::now();
+    // render the full frame the way pixelboardd does for dirty areas
+    for (int y=0; y<c.rows; y++) {
+      c.page->renderSpan(y, 0, c.cols, &frame[y*c.cols]);
+    }
+    c.page->updated();
+    MLMicroSeconds t3 = MainLoop::now();
+    long frameAllocations = numAllocations-a;
+    // render again pixel by pixel
+    for (int y=0; y<c.rows; y++) {
+      for (int x=0; x<c.cols; x++) {
+        frame[y*c.cols+x] = c.page->colorAt(x, y);
+      }
+    }
+    MLMicroSeconds t4 = MainLoop::now();
+    if (measure) {
+      stepTime += t2-t;
+      spanTime += t3-t2;
+      colorAtTime += t4-t3;
+      allocations += frameAllocations;
+      frameNo++;
+      if (frameNo>=numFrames) {
+        report(c);
+        c.page->hide();
+        c.page.reset();
+        caseIndex++;
+        caseStarted = false;
+      }
+    }
+    frameTicket.executeOnce(boost::bind(&PixelBoardBench::benchFrame, this));
+  }
+
+
+  void report(BenchCase &aCase)
+  {
+    double pixels = (double)numFrames*aCase.cols*aCase.rows;
+    double frameTime = (double)(stepTime+spanTime)/numFrames;
+    printf(
+      "%-12s %5dx%-5d %10.0f %10.2f %10.2f %11.2f %8.2f\n",
+      aCase.page->getName().c_str(), aCase.cols, aCase.rows,
+      frameTime>0 ? Second/frameTime : 0,
+      (double)stepTime/numFrames,
+      spanTime*1000.0/pixels,
+      colorAtTime*1000.0/pixels,
+      (double)allocations/numFrames
+    );
+  }
+
+
+  /// @return a plain view filled with a color
+  ViewPtr solidView(int aX, int aY, int aDx, int aDy, PixelColor aColor, int aAlpha)
+  {
+    ViewPtr v = ViewPtr(new View());
+    v->setFrame(aX, aY, aDx, aDy);
+    v->setBackGroundColor(aColor);
+    v->setAlpha(aAlpha);
+    return v;
+  }
+
+
+  /// @return stack of the requested size, optionally with the image tiled in the bottom layer
+  ViewStackPtr baseStack()
+  {
+    ViewStackPtr stack = ViewStackPtr(new ViewStack());
+    stack->setFrame(0, 0, numCols, numRows);
+    stack->setFullFrameContent();
+    stack->setBackGroundColor(black);
+    string image;
+    if (getStringOption("image", image)) {
+      for (int y=0; y<numRows; y+=DEFAULT_NUMROWS) {
+        for (int x=0; x<numCols; x+=DEFAULT_NUMCOLS) {
+          ImageViewPtr tile = ImageViewPtr(new ImageView());
+          tile->setFrame(x, y, DEFAULT_NUMCOLS, DEFAULT_NUMROWS);
+          ErrorPtr err = tile->loadPNG(image);
+          if (!Error::isOK(err)) {
+            LOG(LOG_ERR, "Cannot load benchmark image: %s", err->description().c_str());
+            return stack;
+          }
+          stack->pushView(tile);
+        }
+      }
+    }
+    return stack;
+  }
+
+
+  void addViewBenchmarks()
+  {
+    PixelPageInfoCB infoCB = boost::bind(&PixelBoardBench::pageInfoHandler, this, _1, _2);
+    PixelColor red = { 255, 0, 0, 255 };
+    PixelColor green = { 0, 255, 0, 255 };
+    PixelColor blue = { 0, 0, 255, 255 };
+    // - overlapping semi-transparent layers
+    ViewStackPtr s = baseStack();
+    s->pushView(solidView(0, 0, numCols*2/3, numRows*2/3, red, 128));
+    s->pushView(solidView(numCols/3, numRows/3, numCols*2/3, numRows*2/3, green, 128));
+    s->pushView(solidView(numCols/6, numRows/6, numCols*2/3, numRows*2/3, blue, 128));
+    addCase(PixelPagePtr(new BenchPage("layers", infoCB, s, numCols, numRows)), 0, numCols, numRows);
+    // - scrolling text, one line every 10 columns, running down like on the display page
+    s = baseStack();
+    for (int x=2; x+7<=numCols; x+=10) {
+      TextViewPtr t = TextViewPtr(new TextView(x, 0, numRows, View::down));
+      t->setText("Benchmark text scrolling through");
+      s->pushView(t);
+    }
+    addCase(PixelPagePtr(new BenchPage("text", infoCB, s, numCols, numRows)), 0, numCols, numRows);
+    // - nested stacks: opaque (flattened) and semi-transparent (composited separately), animator fading
+    s = baseStack();
+    ViewStackPtr opaque = ViewStackPtr(new ViewStack());
+    opaque->setFrame(0, 0, numCols/2, numRows);
+    opaque->setFullFrameContent();
+    opaque->pushView(solidView(0, 0, numCols/2, numRows/2, red, 200));
+    s->pushView(opaque);
+    ViewStackPtr translucent = ViewStackPtr(new ViewStack());
+    translucent->setFrame(numCols/4, 0, numCols/2, numRows);
+    translucent->setFullFrameContent();
+    translucent->pushView(solidView(0, numRows/4, numCols/2, numRows/2, green, 255));
+    translucent->setAlpha(100);
+    s->pushView(translucent);
+    ViewAnimatorPtr animator = ViewAnimatorPtr(new ViewAnimator());
+    animator->setFrame(0, 0, numCols, numRows);
+    animator->setFullFrameContent();
+    animator->pushStep(solidView(0, 0, numCols, numRows, blue, 255), 100*MilliSecond, 200*MilliSecond, 200*MilliSecond);
+    animator->pushStep(solidView(0, 0, numCols, numRows, red, 255), 100*MilliSecond, 200*MilliSecond, 200*MilliSecond);
+    animator->setAlpha(80);
+    animator->startAnimation(true);
+    s->pushView(animator);
+    addCase(PixelPagePtr(new BenchPage("nested", infoCB, s, numCols, numRows)), 0, numCols, numRows);
+  }
+
+
+  virtual void initialize()
+  {
+    PixelPageInfoCB infoCB = boost::bind(&PixelBoardBench::pageInfoHandler, this, _1, _2);
+    // the real pages
+    addCase(PixelPagePtr(new DisplayPage(infoCB, numCols, numRows)), pagemode_controls1, numCols, numRows);
+    addCase(PixelPagePtr(new BlocksPage(infoCB, numCols, numRows)), pagemode_controls_mask|pagemode_startnow, numCols, numRows);
+    addCase(PixelPagePtr(new LifePage(infoCB, numCols, numRows)), pagemode_controls1, numCols, numRows);
+    // standard view stacks
+    addViewBenchmarks();
+    printf("%-12s %11s %10s %10s %10s %11s %8s\n", "benchmark", "size", "fps", "step uS", "span ns/px", "pixel ns/px", "allocs");
+    benchFrame();
+  }
+
+};
+
+
+int main(int argc, char **argv)
+{
+  // prevent debug output before application.main scans command line
+  SETLOGLEVEL(LOG_EMERG);
+  SETERRLEVEL(LOG_EMERG, false); // messages, if any, go to stderr
+  // create app with current mainloop
+  static PixelBoardBench application;
+  // pass control
+  return application.main(argc, argv);
+}
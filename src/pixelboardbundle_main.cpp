@@ -0,0 +1,93 @@
+//
+//  Copyright (c) 2017 plan44.ch / Lukas Zeller, Zurich, Switzerland
+//
+//  Author: Lukas Zeller <luz@plan44.ch>
+//
+//  This file is part of pixelboardd.
+//
+//  pixelboardd is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  pixelboardd is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with pixelboardd. If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#include "application.hpp"
+
+#include "resourcebundle.hpp"
+
+using namespace p44;
+
+#define DEFAULT_LOGLEVEL LOG_NOTICE
+
+
+// MARK: ===== bundle tool application
+
+/// builds the resource bundle from the loose files in a resource folder
+class PixelBoardBundle : public CmdLineApp
+{
+  typedef CmdLineApp inherited;
+
+public:
+
+  virtual int main(int argc, char **argv)
+  {
+    const char *usageText =
+      "Usage: %1$s [options] <resource folder> <bundle file>\n"
+      "Packs all PNG images below <resource folder>/images, pre-decoded, into a resource bundle for pixelboardd\n";
+    const CmdLineOptionDescriptor options[] = {
+      { 'l', "loglevel",       true,  "level;set max level of log message detail to show on stdout" },
+      { 'h', "help",           false, "show this text" },
+      { 0, NULL } // list terminator
+    };
+
+    // parse the command line, exits when syntax errors occur
+    setCommandDescriptors(usageText, options);
+    parseCommandLine(argc, argv);
+
+    if (getOption("help") || numArguments()!=2) {
+      // show usage
+      showUsage();
+      terminateApp(EXIT_SUCCESS);
+    }
+
+    if (!isTerminated()) {
+      int loglevel = DEFAULT_LOGLEVEL;
+      getIntOption("loglevel", loglevel);
+      SETLOGLEVEL(loglevel);
+      int numImages;
+      ErrorPtr err = ResourceBundle::build(getArgument(0), getArgument(1), numImages);
+      if (!Error::isOK(err)) {
+        LOG(LOG_ERR, "Cannot build resource bundle: %s", err->description().c_str());
+        terminateApp(EXIT_FAILURE);
+      }
+      else {
+        LOG(LOG_NOTICE, "Bundled %d images into %s", numImages, getArgument(1).c_str());
+        terminateApp(EXIT_SUCCESS);
+      }
+    }
+    // nothing to run, just cleanup
+    return run();
+  }
+
+};
+
+
+int main(int argc, char **argv)
+{
+  // prevent debug output before application.main scans command line
+  SETLOGLEVEL(LOG_EMERG);
+  SETERRLEVEL(LOG_EMERG, false); // messages, if any, go to stderr
+  // create app with current mainloop
+  static PixelBoardBundle application;
+  // pass control
+  return application.main(argc, argv);
+}
@@ -30,11 +30,36 @@
 #include "blocks.hpp"
 #include "display.hpp"
 #include "life.hpp"
+#include "ledoutput.hpp"
+#include "framerenderer.hpp"
+#include "imagecache.hpp"
+#include "resourcebundle.hpp"
+#include "stats.hpp"
 
 using namespace p44;
 
 #define DEFAULT_LOGLEVEL LOG_NOTICE
 
+#define MIN_STEP_INTERVAL (10*MilliSecond) // limits the frame rate of time based changes
+#define INPUT_POLL_INTERVAL (10*MilliSecond) // touch pad polling interval
+
+#define SIM_BATCH_TIME (20*MilliSecond) // real time to spend simulating before letting the mainloop handle I/O
+#define SIM_REPORT_INTERVAL (1*Hour) // simulated time between progress reports
+
+
+/// scripted input for simulation mode
+class SimEvent
+{
+  friend class PixelBoardD;
+
+  MLMicroSeconds at; ///< time since start of simulation
+  string page; ///< page to go to, empty for key events
+  PageMode mode; ///< mode to show the page in, 0 for default mode
+  int side; ///< side the key is pressed on
+  KeyCodes key; ///< key pressed
+};
+typedef std::vector<SimEvent> SimScript;
+
 
 typedef std::map<string, PixelPagePtr> PagesMap;
 
@@ -42,7 +67,10 @@ class PixelBoardD : public CmdLineApp
 {
   typedef CmdLineApp inherited;
 
-  LEDChainCommPtr display;
+  LEDOutputPtr ledOutput;
+  bool outputThread;
+  FrameRendererPtr renderer;
+  bool renderThread;
   bool upsideDown;
 
   ButtonInputPtr lower_left;
@@ -71,8 +99,35 @@ class PixelBoardD : public CmdLineApp
   PageMode defaultMode;
   PagesMap pages;
   PixelPagePtr currentPage; ///< the current page
-  MLTicket stepTicket;
-  MLTicket startDelayTicket;
+  BoardTicket stepTicket; ///< scheduled for the next time the current page needs to be stepped
+  bool updatePending; ///< set when stepTicket is scheduled for an immediate update
+  bool stepping; ///< set while stepping and updating the display (changes are picked up anyway)
+  MLTicket inputTicket;
+  BoardTicket startDelayTicket;
+
+  // board geometry
+  int numCols; ///< number of columns (X) of the board
+  int numRows; ///< number of rows (Y) of the board
+
+  // statistics
+  LatencyHistogram stepTimes; ///< time spent in the current page's step()
+  LatencyHistogram inputTimes; ///< time spent polling the touch pads
+  LatencyHistogram stepLateness; ///< how late steps run compared to when they were scheduled
+  MLMicroSeconds plannedStepTime; ///< when the currently scheduled step should run
+
+  // simulation
+  bool simulating; ///< set when running on virtual time, without LEDs and touch pads
+  MLMicroSeconds simulationStart; ///< virtual time when the simulation started
+  MLMicroSeconds simulationEnd; ///< virtual time when the simulation ends
+  MLMicroSeconds simKeyInterval; ///< average interval between random key presses, 0 if none
+  MLMicroSeconds simPageInterval; ///< interval between page changes, 0 if none
+  MLMicroSeconds nextSimReport; ///< virtual time of the next progress report
+  SimScript simScript; ///< scripted inputs
+  size_t simScriptIndex; ///< next scripted input
+  MLTicket simulationTicket; ///< runs the simulation from the (real time) mainloop
+  BoardTicket simKeyTicket;
+  BoardTicket simPageTicket;
+  BoardTicket simScriptTicket;
 
   // sound channels
   SoundChannelPtr sound;
@@ -90,7 +145,18 @@ public:
 
   PixelBoardD() :
     starttime(MainLoop::now()),
+    outputThread(true),
+    renderThread(false),
     upsideDown(false),
+    numCols(DEFAULT_NUMCOLS),
+    numRows(DEFAULT_NUMROWS),
+    updatePending(false),
+    stepping(false),
+    plannedStepTime(Never),
+    simulating(false),
+    simKeyInterval(1*Second),
+    simPageInterval(10*Minute),
+    simScriptIndex(0),
     defaultMode(pagemode_controls1)
   {
   }
@@ -101,6 +167,7 @@ public:
       "Usage: %1$s [options]\n";
     const CmdLineOptionDescriptor options[] = {
       { 0  , "ledchain",       true,  "device;set device to send LED chain data to" },
+      { 0  , "ledmap",         true,  "filename;JSON config mapping board regions to multiple LED chains (instead of --ledchain)" },
       { 0  , "touchsel",       true,  "pinspec;touchboard selection signal" },
       { 0  , "touchdetect",    true,  "pinspec;touchboard touch detect signal" },
       { 0  , "touchreset",     true,  "pinspec;touchboard reset signal" },
@@ -111,6 +178,10 @@ public:
       { 0  , "soundvol",       true,  "volume;initial sound effects volume" },
       { 0  , "musicvol",       true,  "volume;initial music volume" },
       { 'u', "upsidedown",     false, "use board upside down" },
+      { 0  , "cols",           true,  "columns;number of columns (X) of the board (default=10)" },
+      { 0  , "rows",           true,  "rows;number of rows (Y) of the board (default=20)" },
+      { 0  , "syncoutput",     false, "transmit frames to the LED chain synchronously from the main loop instead of from a separate thread" },
+      { 0  , "renderthread",   false, "composite frames from snapshots of the page in a separate thread instead of on the main loop" },
       { 0  , "consolekeys",    false, "allow controlling via console keys" },
       { 0  , "notouch",        false, "disable touch pad checking" },
       { 0  , "jsonapiport",    true,  "port;server port number for JSON API (default=none)" },
@@ -118,6 +189,15 @@ public:
       { 0  , "defaultpage",    true,  "display page;default page to show after start and after other page ends" },
       { 0  , "defaultmode",    true,  "mode;defines default page mode: 1=normal, 2=reversed, 3=twosided" },
       { 0  , "image",          true,  "filename;image to show by default on display page" },
+      { 0  , "animation",      true,  "filename;sprite sheet with board sized frames stacked vertically, to animate on display page" },
+      { 0  , "panorama",       true,  "filename;wide image to scroll across display page" },
+      { 0  , "imagecache",     true,  "kilobytes;memory budget for decoded images (default=1024)" },
+      { 0  , "bundle",         true,  "filename;resource bundle with pre-decoded images (default=pixelboard.bundle in resource path, if present)" },
+      { 0  , "simulate",       true,  "seconds;run for the given time on virtual time as fast as possible, without LEDs and touch pads" },
+      { 0  , "simkeys",        true,  "milliseconds;average interval of random key presses in simulation (default=1000, 0=none)" },
+      { 0  , "simpages",       true,  "seconds;interval of cycling through pages in simulation (default=600, 0=none)" },
+      { 0  , "simscript",      true,  "filename;timed inputs for simulation, lines: <seconds> key <side> left|right|turn|drop, or <seconds> page <name> [<mode>]" },
+      { 0  , "simseed",        true,  "seed;random seed for simulation (default=42)" },
       { 0  , "message",        true,  "message;text to show from time to time on display page" },
       { 'l', "loglevel",       true,  "level;set max level of log message detail to show on stdout" },
       { 0  , "errlevel",       true,  "level;set max level for log messages to go to stderr as well" },
@@ -150,11 +230,68 @@ public:
       SETERRLEVEL(errlevel, !getOption("dontlogerrors"));
       SETDELTATIME(getOption("deltatstamps"));
 
-      // create the LED chain
+      // simulation
+      int simSeconds;
+      if (getIntOption("simulate", simSeconds)) {
+        simulating = true;
+        simulationStart = MainLoop::now();
+        simulationEnd = simulationStart+simSeconds*Second;
+        nextSimReport = simulationStart+SIM_REPORT_INTERVAL;
+        // all board timing must run on virtual time from now on
+        BoardClock::sharedClock().startVirtualTime(simulationStart);
+        int i;
+        if (getIntOption("simkeys", i)) simKeyInterval = i*MilliSecond;
+        if (getIntOption("simpages", i)) simPageInterval = i*Second;
+        string scriptfile;
+        if (getStringOption("simscript", scriptfile)) {
+          ErrorPtr err = loadSimScript(scriptfile);
+          if (!Error::isOK(err)) {
+            LOG(LOG_ERR, "Cannot load simulation script: %s", err->description().c_str());
+            terminateApp(EXIT_FAILURE);
+          }
+        }
+      }
+
+      // board geometry
+      getIntOption("cols", numCols);
+      getIntOption("rows", numRows);
+      if (numCols<1 || numRows<1) {
+        LOG(LOG_ERR, "Invalid board geometry %d x %d", numCols, numRows);
+        terminateApp(EXIT_FAILURE);
+        return run();
+      }
+      // create the LED output
+      ledOutput = LEDOutputPtr(new LEDOutput(numCols, numRows));
       upsideDown = getOption("upsidedown");
-      string leddev = "/tmp/ledchainsim";
-      getStringOption("ledchain", leddev);
-      display = LEDChainCommPtr(new LEDChainComm(LEDChainComm::ledtype_ws281x, leddev, 200, 20, upsideDown, true, true, !upsideDown));
+      if (!simulating) {
+        string mapfile;
+        if (getStringOption("ledmap", mapfile)) {
+          // multiple LED chains
+          ErrorPtr err;
+          JsonObjectPtr map = JsonObject::objFromFile(mapfile.c_str(), &err);
+          if (Error::isOK(err)) err = ledOutput->addChainsFromMap(map);
+          if (!Error::isOK(err)) {
+            LOG(LOG_ERR, "Cannot load LED chain map: %s", err->description().c_str());
+            terminateApp(EXIT_FAILURE);
+            return run();
+          }
+        }
+        else {
+          // single LED chain for the entire board
+          // - LEDs run along the columns, so a chain row is a board column
+          string leddev = "/tmp/ledchainsim";
+          getStringOption("ledchain", leddev);
+          PixelRect board = { .x=0, .y=0, .dx=numCols, .dy=numRows };
+          ledOutput->addChain(LEDChainComm::ledtype_ws281x, leddev, board, numRows, upsideDown, true, true, !upsideDown);
+        }
+      }
+      // LEDs are written from a separate thread, so composing the next frame and handling inputs
+      // is not blocked while a frame is on the wire. Simulation has no LEDs and runs synchronously.
+      outputThread = !getOption("syncoutput") && !simulating;
+      // frames can be composited from a separate thread, so slow API requests and inputs do not delay them
+      renderThread = getOption("renderthread") && !simulating;
+      renderer = FrameRendererPtr(new FrameRenderer(ledOutput, numCols, numRows));
+      renderer->setFrameRenderedHandler(boost::bind(&PixelBoardD::frameRendered, this, _1));
 
       // - start API server and wait for things to happen
       string apiport;
@@ -186,21 +323,57 @@ public:
         }
       }
 
+      // image cache
+      int kb;
+      if (getIntOption("imagecache", kb)) {
+        ImageCache::sharedImageCache().setBudget((size_t)kb*1024);
+      }
+      // resource bundle (images not in the bundle are loaded from loose files)
+      string bundle;
+      if (getStringOption("bundle", bundle)) {
+        ErrorPtr err = ResourceBundle::sharedBundle().open(bundle);
+        if (!Error::isOK(err)) {
+          LOG(LOG_ERR, "Cannot use resource bundle: %s", err->description().c_str());
+        }
+      }
+      else {
+        bundle = resourcePath("pixelboard.bundle");
+        if (access(bundle.c_str(), R_OK)==0) {
+          ResourceBundle::sharedBundle().open(bundle);
+        }
+      }
+
       // add pages
       // - display
-      displayPage = DisplayPagePtr(new DisplayPage(boost::bind(&PixelBoardD::pageInfoHandler, this, _1, _2)));
+      displayPage = DisplayPagePtr(new DisplayPage(boost::bind(&PixelBoardD::pageInfoHandler, this, _1, _2), numCols, numRows));
       string s;
       if (getStringOption("image", s)) {
         displayPage->loadPNGBackground(s);
       }
+      if (getStringOption("animation", s)) {
+        JsonObjectPtr a = JsonObject::newObj();
+        a->add("sheet", JsonObject::newString(s));
+        ErrorPtr err = displayPage->loadAnimation(a);
+        if (!Error::isOK(err)) {
+          LOG(LOG_ERR, "Animation cannot be shown: %s", err->description().c_str());
+        }
+      }
+      if (getStringOption("panorama", s)) {
+        JsonObjectPtr p = JsonObject::newObj();
+        p->add("image", JsonObject::newString(s));
+        ErrorPtr err = displayPage->loadPanorama(p);
+        if (!Error::isOK(err)) {
+          LOG(LOG_ERR, "Panorama cannot be shown: %s", err->description().c_str());
+        }
+      }
       if (getStringOption("message", s)) {
         displayPage->setDefaultMessage(s);
       }
       // - blocks
-      blocksPage = BlocksPagePtr(new BlocksPage(boost::bind(&PixelBoardD::pageInfoHandler, this, _1, _2)));
+      blocksPage = BlocksPagePtr(new BlocksPage(boost::bind(&PixelBoardD::pageInfoHandler, this, _1, _2), numCols, numRows));
       blocksPage->setSoundChannels(sound, music);
       // - life
-      lifePage = LifePagePtr(new LifePage(boost::bind(&PixelBoardD::pageInfoHandler, this, _1, _2)));
+      lifePage = LifePagePtr(new LifePage(boost::bind(&PixelBoardD::pageInfoHandler, this, _1, _2), numCols, numRows));
 
 
       if (getOption("consolekeys")) {
@@ -229,7 +402,7 @@ public:
       }
 
       // create the touch pad controls
-      if (!getOption("notouch")) {
+      if (!getOption("notouch") && !simulating) {
         string touchdetectname = "/gpio.19";
         string touchresetname = "gpio.15";
         getStringOption("touchdetect", touchdetectname);
@@ -271,7 +444,7 @@ public:
       currentPage = pos->second;
       currentPage->show(aMode);
     }
-    updateDisplay();
+    requestUpdate();
   }
 
 
@@ -281,6 +454,7 @@ public:
     LOG(LOG_INFO, "Page '%s' sends info '%s'", aPage.getName().c_str(), aInfo.c_str());
     if (aInfo=="register") {
       pages[aPage.getName()] = PixelPagePtr(&aPage);
+      aPage.setNeedUpdateHandler(boost::bind(&PixelBoardD::requestUpdate, this));
     }
     else if (aInfo=="unregister") {
       PagesMap::iterator pos = pages.find(aPage.getName());
@@ -307,11 +481,30 @@ public:
 
   virtual void initialize()
   {
-    srand((unsigned)MainLoop::currentMainLoop().now()*4223);
-    display->begin();
-    display->show();
-    stepTicket.executeOnce(boost::bind(&PixelBoardD::step, this, _1));
+    if (simulating) {
+      int seed = 42;
+      getIntOption("simseed", seed);
+      srand(seed);
+    }
+    else {
+      srand((unsigned)MainLoop::currentMainLoop().now()*4223);
+      ledOutput->begin();
+    }
+    if (outputThread) {
+      ledOutput->startThread();
+    }
+    if (renderThread) {
+      renderer->startThread();
+    }
+    requestUpdate();
+    if (touchDevL || touchDevH) {
+      // touch pads have no event mechanism, must be polled
+      inputTicket.executeOnce(boost::bind(&PixelBoardD::pollInputs, this, _1));
+    }
     startDelayTicket.executeOnce(boost::bind(&PixelBoardD::gotoPage, this, defaultPageName, defaultMode), 2*Second);
+    if (simulating) {
+      startSimulation();
+    }
   }
 
 
@@ -378,6 +571,16 @@ public:
   }
 
 
+  KeyCodes keyCodeForName(const string aKeyName)
+  {
+    if (aKeyName=="left") return keycode_left;
+    if (aKeyName=="right") return keycode_right;
+    if (aKeyName=="turn") return keycode_middleleft;
+    if (aKeyName=="drop") return keycode_middleright;
+    return keycode_none;
+  }
+
+
   void requestHandled(JsonCommPtr aConnection, JsonObjectPtr aResponse, ErrorPtr aError)
   {
     if (!aResponse) {
@@ -400,16 +603,10 @@ public:
       int side = aUri=="player2" ? 1 : 0;
       if (aIsAction) {
         if (aData->get("key", o)) {
-          string key = o->stringValue();
+          KeyCodes key = keyCodeForName(o->stringValue());
           // Note: assume keys are already released when event is reported
-          if (key=="left")
-            keyHandler(side, keycode_left, keycode_none);
-          else if (key=="right")
-            keyHandler(side, keycode_right, keycode_none);
-          else if (key=="turn")
-            keyHandler(side, keycode_middleleft, keycode_none);
-          else if (key=="drop")
-            keyHandler(side, keycode_middleright, keycode_none);
+          if (key!=keycode_none)
+            keyHandler(side, key, keycode_none);
         }
       }
       aRequestDoneCB(JsonObjectPtr(), ErrorPtr());
@@ -460,15 +657,14 @@ public:
         flipped = o->boolValue();
       }
       if (!onlychanged || displayMirrorDirty) {
-        for (int y=PAGE_NUMROWS-1; y>=0; y--) {
-          for (int x=0; x<PAGE_NUMCOLS; x++) {
+        for (int y=numRows-1; y>=0; y--) {
+          for (int x=0; x<numCols; x++) {
             if (flipped) {
-              x = PAGE_NUMCOLS-1-x;
-              y = PAGE_NUMROWS-1-y;
+              x = numCols-1-x;
+              y = numRows-1-y;
             }
-            uint8_t r,g,b,w;
-            display->getColorXY(x, y, r, g, b, w);
-            answer->arrayAppend(JsonObject::newString(string_format("#%02X%02X%02X", r, g, b)));
+            PixelColor p = ledOutput->colorAt(x, y);
+            answer->arrayAppend(JsonObject::newString(string_format("#%02X%02X%02X", p.r, p.g, p.b)));
           }
         }
       }
@@ -476,6 +672,39 @@ public:
       aRequestDoneCB(answer, err);
       return true;
     }
+    else if (aUri=="stats") {
+      // display statistics
+      if (aIsAction && aData && aData->get("reset", o) && o->boolValue()) {
+        stepTimes.reset();
+        inputTimes.reset();
+        renderer->getComposeTimes().reset();
+        renderer->getSnapshotTimes().reset();
+        stepLateness.reset();
+        ledOutput->getShowTimes().reset();
+      }
+      JsonObjectPtr answer;
+      if (aData && aData->get("format", o) && o->stringValue()=="flat") {
+        // flat object with the same names as the text statistics, for scraping
+        answer = statsFlat();
+      }
+      else {
+        answer = JsonObject::newObj();
+        answer->add("framesRendered", JsonObject::newInt64(renderer->getFramesRendered()));
+        answer->add("framesSent", JsonObject::newInt64(ledOutput->getFramesSent()));
+        answer->add("framesSkipped", JsonObject::newInt64(ledOutput->getFramesSkipped()));
+        answer->add("framesOverrun", JsonObject::newInt64(ledOutput->getFramesOverrun()));
+        answer->add("framesDropped", JsonObject::newInt64(ledOutput->getFramesDropped()));
+        answer->add("step", stepTimes.json());
+        answer->add("inputs", inputTimes.json());
+        answer->add("compose", renderer->getComposeTimes().json());
+        answer->add("snapshot", renderer->getSnapshotTimes().json());
+        answer->add("show", ledOutput->getShowTimes().json());
+        answer->add("lateness", stepLateness.json());
+        answer->add("imageCache", ImageCache::sharedImageCache().json());
+      }
+      aRequestDoneCB(answer, ErrorPtr());
+      return true;
+    }
     else if (aUri=="page") {
       // ask each page
       for (PagesMap::iterator pos = pages.begin(); pos!=pages.end(); ++pos) {
@@ -493,9 +722,9 @@ public:
       if (aData->get("cmd", o))
         cmd = o->stringValue();
       if (cmd=="imageupload" && displayPage) {
-        ErrorPtr err = displayPage->loadPNGBackground(uploadedfile);
-        gotoPage("display", false);
-        aRequestDoneCB(JsonObjectPtr(), err);
+        // decode in background, answer (and let the upload file go) when done
+        // - upload temp file names get reused, and the file is gone afterwards: do not cache
+        displayPage->loadPNGBackground(uploadedfile, boost::bind(&PixelBoardD::imageUploaded, this, aRequestDoneCB, _1), false);
         return true;
       }
     }
@@ -503,24 +732,52 @@ public:
   }
 
 
-  ErrorPtr processUpload(string aUri, JsonObjectPtr aData, const string aUploadedFile)
+  void imageUploaded(RequestDoneCB aRequestDoneCB, ErrorPtr aError)
   {
-    ErrorPtr err;
-
-    string cmd;
-    JsonObjectPtr o;
-    if (aData->get("cmd", o)) {
-      cmd = o->stringValue();
-      if (cmd=="imageupload") {
-        displayPage->loadPNGBackground(aUploadedFile);
-        gotoPage("display", false);
-        updateDisplay();
-      }
-      else {
-        err = WebError::webErr(500, "Unknown upload cmd '%s'", cmd.c_str());
-      }
+    if (Error::isOK(aError)) {
+      gotoPage("display", false);
     }
-    return err;
+    else {
+      LOG(LOG_ERR, "Uploaded image cannot be shown: %s", aError->description().c_str());
+    }
+    if (aRequestDoneCB) aRequestDoneCB(JsonObjectPtr(), aError);
+  }
+
+
+  /// @return statistics as a flat JSON object, with the same names as statsText()
+  JsonObjectPtr statsFlat()
+  {
+    JsonObjectPtr s = JsonObject::newObj();
+    s->add("frames_rendered", JsonObject::newInt64(renderer->getFramesRendered()));
+    s->add("frames_sent", JsonObject::newInt64(ledOutput->getFramesSent()));
+    s->add("frames_skipped", JsonObject::newInt64(ledOutput->getFramesSkipped()));
+    s->add("frames_overrun", JsonObject::newInt64(ledOutput->getFramesOverrun()));
+    s->add("frames_dropped", JsonObject::newInt64(ledOutput->getFramesDropped()));
+    stepTimes.addFlatFields(s, "step");
+    inputTimes.addFlatFields(s, "inputs");
+    renderer->getComposeTimes().addFlatFields(s, "compose");
+    renderer->getSnapshotTimes().addFlatFields(s, "snapshot");
+    ledOutput->getShowTimes().addFlatFields(s, "show");
+    stepLateness.addFlatFields(s, "lateness");
+    return s;
+  }
+
+
+  /// @return statistics as plain "name value" lines, for the log
+  string statsText()
+  {
+    string t = string_format(
+      "frames_rendered %ld\nframes_sent %ld\nframes_skipped %ld\nframes_overrun %ld\nframes_dropped %ld\n",
+      renderer->getFramesRendered(), ledOutput->getFramesSent(), ledOutput->getFramesSkipped(),
+      ledOutput->getFramesOverrun(), ledOutput->getFramesDropped()
+    );
+    t += stepTimes.text("step");
+    t += inputTimes.text("inputs");
+    t += renderer->getComposeTimes().text("compose");
+    t += renderer->getSnapshotTimes().text("snapshot");
+    t += ledOutput->getShowTimes().text("show");
+    t += stepLateness.text("lateness");
+    return t;
   }
 
 
@@ -559,41 +816,228 @@ public:
         kd->getBus().SMBusWriteByte(kd.get(), 0x14, ledmask);
       }
     }
-    updateDisplay();
+  }
+
+
+  void pollInputs(MLTimer &aTimer)
+  {
+    MLMicroSeconds start = MainLoop::now();
+    checkInputs();
+    inputTimes.add(MainLoop::now()-start);
+    MainLoop::currentMainLoop().retriggerTimer(aTimer, INPUT_POLL_INTERVAL);
   }
 
 
 
 
+  /// composite the changed area of the current page and submit it to the LED output
+  /// @note with the render thread, only a snapshot of the page is taken here. If the previous frame is
+  ///   still being rendered, the page remains dirty and is rendered from frameRendered() later.
   void updateDisplay()
   {
     if (currentPage && currentPage->isDirty()) {
-      displayMirrorDirty = true;
-      for (int x=0; x<PAGE_NUMCOLS; x++) {
-        for (int y=0; y<PAGE_NUMROWS; y++) {
-          PixelColor p = currentPage->colorAt(x, y);
-          display->setColorXY(x, y, p.r, p.g, p.b);
-        }
-      }
-      display->show();
-      currentPage->updated();
+      renderer->renderPage(*currentPage);
     }
   }
 
 
+  /// called on the main loop when a frame has been rendered
+  void frameRendered(bool aChanged)
+  {
+    if (aChanged) displayMirrorDirty = true;
+    // render changes made while the render thread was busy (nothing to do when rendered directly)
+    updateDisplay();
+  }
+
+
+
+  /// request stepping the current page and updating the display as soon as possible
+  /// @note called by pages when something has changed outside of step(), such as by timers or API requests
+  void requestUpdate()
+  {
+    if (stepping || updatePending) return; // will be picked up by the running or already scheduled step
+    updatePending = true;
+    plannedStepTime = BoardClock::now();
+    stepTicket.executeOnce(boost::bind(&PixelBoardD::step, this));
+  }
+
 
-  void step(MLTimer &aTimer)
+  void step()
   {
+    stepLateness.add(BoardClock::now()-plannedStepTime);
+    MLMicroSeconds start = MainLoop::now();
+    updatePending = false;
+    stepping = true;
     bool completed = true;
     if (currentPage) {
       completed = currentPage->step();
+      stepTimes.add(MainLoop::now()-start);
     }
-    checkInputs();
     updateDisplay();
-    MainLoop::currentMainLoop().retriggerTimer(aTimer, 10*MilliSecond);
+    stepping = false;
+    // sleep until the next time based change (or until requestUpdate() is called)
+    MLMicroSeconds next = Infinite;
+    if (currentPage) {
+      next = completed ? currentPage->nextStepTime() : BoardClock::now();
+    }
+    if (next!=Infinite) {
+      MLMicroSeconds earliest = BoardClock::now()+MIN_STEP_INTERVAL;
+      plannedStepTime = next<earliest ? earliest : next;
+      stepTicket.executeOnceAt(boost::bind(&PixelBoardD::step, this), plannedStepTime);
+    }
+  }
+
+
+  // MARK: ===== simulation
+
+  ErrorPtr loadSimScript(const string aFileName)
+  {
+    FILE *f = fopen(aFileName.c_str(), "r");
+    if (!f) return SysError::errNo();
+    char line[256];
+    int lineNo = 0;
+    ErrorPtr err;
+    while (fgets(line, sizeof(line), f)) {
+      lineNo++;
+      double seconds;
+      char cmd[20], arg1[64], arg2[64];
+      int n = sscanf(line, "%lf %19s %63s %63s", &seconds, cmd, arg1, arg2);
+      if (n<=0 || line[0]=='#') continue; // empty line or comment
+      SimEvent e;
+      e.at = seconds*Second;
+      e.mode = 0;
+      e.side = 0;
+      e.key = keycode_none;
+      if (n>=3 && strcmp(cmd, "page")==0) {
+        e.page = arg1;
+        if (n>=4) e.mode = atoi(arg2);
+      }
+      else if (n>=4 && strcmp(cmd, "key")==0) {
+        e.side = atoi(arg1);
+        e.key = keyCodeForName(arg2);
+      }
+      if (e.page.empty() && e.key==keycode_none) {
+        err = TextError::err("%s:%d: invalid simulation event", aFileName.c_str(), lineNo);
+        break;
+      }
+      simScript.push_back(e);
+    }
+    fclose(f);
+    return err;
+  }
+
+
+  void startSimulation()
+  {
+    LOG(LOG_NOTICE, "Simulating %lld seconds on virtual time", (long long)(simulationEnd-simulationStart)/Second);
+    if (simKeyInterval>0) simulateKey();
+    if (simPageInterval>0) simPageTicket.executeOnce(boost::bind(&PixelBoardD::simulatePageChange, this), simPageInterval);
+    if (simScriptIndex<simScript.size()) {
+      simScriptTicket.executeOnceAt(boost::bind(&PixelBoardD::simulateScriptEvent, this), simulationStart+simScript[simScriptIndex].at);
+    }
+    simulationTicket.executeOnce(boost::bind(&PixelBoardD::runSimulation, this, _1));
   }
 
 
+  void runSimulation(MLTimer &aTimer)
+  {
+    BoardClock &clock = BoardClock::sharedClock();
+    MLMicroSeconds batchEnd = MainLoop::now()+SIM_BATCH_TIME;
+    do {
+      MLMicroSeconds next = clock.nextTimerTime();
+      if (next>simulationEnd) {
+        // nothing more happens before end of simulation
+        clock.advanceTo(simulationEnd);
+        endSimulation();
+        return;
+      }
+      clock.advanceTo(next);
+      if (BoardClock::now()>=nextSimReport) {
+        reportSimulation();
+        nextSimReport += SIM_REPORT_INTERVAL;
+      }
+    } while (MainLoop::now()<batchEnd);
+    // let the mainloop handle I/O (such as API requests) before continuing
+    MainLoop::currentMainLoop().retriggerTimer(aTimer, 0);
+  }
+
+
+  /// @return resident memory in kB, -1 if not available
+  long residentMemory()
+  {
+    long kb = -1;
+    FILE *f = fopen("/proc/self/statm", "r");
+    if (f) {
+      long size, resident;
+      if (fscanf(f, "%ld %ld", &size, &resident)==2) {
+        kb = resident*(sysconf(_SC_PAGESIZE)/1024);
+      }
+      fclose(f);
+    }
+    return kb;
+  }
+
+
+  void reportSimulation()
+  {
+    LOG(LOG_NOTICE,
+      "Simulated %.1f hours in %.1f seconds: %ld frames rendered, %ld sent, resident memory %ld kB",
+      (double)(BoardClock::now()-simulationStart)/Hour,
+      (double)(MainLoop::now()-starttime)/Second,
+      renderer->getFramesRendered(), ledOutput->getFramesSent(),
+      residentMemory()
+    );
+  }
+
+
+  void endSimulation()
+  {
+    reportSimulation();
+    LOG(LOG_NOTICE, "Simulation statistics:\n%s", statsText().c_str());
+    terminateApp(EXIT_SUCCESS);
+  }
+
+
+  void simulateKey()
+  {
+    int side = rand() % 2;
+    KeyCodes key = (KeyCodes)(1<<(rand() % 4));
+    keyHandler(side, key, keycode_none);
+    // next key after a random time averaging simKeyInterval
+    simKeyTicket.executeOnce(boost::bind(&PixelBoardD::simulateKey, this), (rand() % (2*simKeyInterval/MilliSecond+1))*MilliSecond);
+  }
+
+
+  void simulatePageChange()
+  {
+    // go to the page following the current one
+    PagesMap::iterator pos = currentPage ? pages.find(currentPage->getName()) : pages.end();
+    if (pos!=pages.end()) ++pos;
+    if (pos==pages.end()) pos = pages.begin();
+    if (pos!=pages.end()) {
+      gotoPage(pos->first, defaultMode);
+    }
+    simPageTicket.executeOnce(boost::bind(&PixelBoardD::simulatePageChange, this), simPageInterval);
+  }
+
+
+  void simulateScriptEvent()
+  {
+    SimEvent &e = simScript[simScriptIndex++];
+    if (!e.page.empty()) {
+      gotoPage(e.page, e.mode ? e.mode : defaultMode);
+    }
+    else {
+      keyHandler(e.side, e.key, keycode_none);
+    }
+    if (simScriptIndex<simScript.size()) {
+      simScriptTicket.executeOnceAt(boost::bind(&PixelBoardD::simulateScriptEvent, this), simulationStart+simScript[simScriptIndex].at);
+    }
+  }
+
+
+  // MARK: ===== inputs
+
   void keyHandler(int aSide, KeyCodes aNewPressedKeys, KeyCodes aCurrentPressed)
   {
     // if (sound && aNewPressedKeys) sound->play(Application::sharedApplication()->resourcePath("sounds/tap.wav"));
@@ -615,7 +1059,7 @@ public:
         currentPage->handleKey(aSide, aNewPressedKeys, aCurrentPressed);
       }
     }
-    updateDisplay();
+    requestUpdate(); // key might have changed timing (e.g. dropping block) without changing the display
   }
 
 
@@ -27,9 +27,12 @@ using namespace p44;
 // MARK: ===== PixelPage
 
 
-PixelPage::PixelPage(const string aName, PixelPageInfoCB aInfoCallback) :
+PixelPage::PixelPage(const string aName, PixelPageInfoCB aInfoCallback, int aNumCols, int aNumRows) :
   name(aName),
-  infoCallback(aInfoCallback)
+  infoCallback(aInfoCallback),
+  dirty(true),
+  numCols(aNumCols),
+  numRows(aNumRows)
 {
   postInfo("register");
 }
@@ -37,6 +40,7 @@ PixelPage::PixelPage(const string aName, PixelPageInfoCB aInfoCallback) :
 
 PixelPage::~PixelPage()
 {
+  if (view) view->setNeedUpdateHandler(NULL);
   postInfo("unregister");
 }
 
@@ -49,6 +53,13 @@ bool PixelPage::step()
 }
 
 
+MLMicroSeconds PixelPage::nextStepTime()
+{
+  if (view) return view->nextStepTime();
+  return Infinite; // nothing to step
+}
+
+
 PixelColor PixelPage::colorAt(int aX, int aY)
 {
   if (view) return view->colorAt(aX, aY);
@@ -56,6 +67,26 @@ PixelColor PixelPage::colorAt(int aX, int aY)
 }
 
 
+void PixelPage::renderSpan(int aY, int aX0, int aX1, PixelColor *aOut)
+{
+  if (view) {
+    view->renderSpan(aY, aX0, aX1, aOut);
+  }
+  else {
+    for (int x=aX0; x<aX1; x++) {
+      *aOut++ = colorAt(x, aY);
+    }
+  }
+}
+
+
+ViewPtr PixelPage::snapshot()
+{
+  if (view) return view->snapshot();
+  return ViewPtr(); // no view, page is transparent
+}
+
+
 bool PixelPage::handleKey(int aSide, KeyCodes aNewPressedKeys, KeyCodes aCurrentPressed)
 {
   // by default, any key quits current page
@@ -78,6 +109,17 @@ bool PixelPage::isDirty()
 };
 
 
+PixelRect PixelPage::getDirtyRect()
+{
+  PixelRect r = { .x=0, .y=0, .dx=numCols, .dy=numRows };
+  if (!dirty) {
+    if (!view) return zeroRect;
+    rectIntersect(r, view->getDirtyRect());
+  }
+  return r;
+}
+
+
 void PixelPage::updated()
 {
   dirty = false;
@@ -87,7 +129,9 @@ void PixelPage::updated()
 
 void PixelPage::setView(ViewPtr aView)
 {
+  if (view) view->setNeedUpdateHandler(NULL);
   view = aView;
+  if (view) view->setNeedUpdateHandler(boost::bind(&PixelPage::needUpdate, this));
   makeDirty(); // new view, must redisplay
 }
 
@@ -96,7 +140,7 @@ void PixelPage::sizeViewToPage(ViewPtr aView)
 {
   if (!aView) aView = view; // default is my own view
   if (aView) {
-    aView->setFrame(0, 0, PAGE_NUMCOLS, PAGE_NUMROWS);
+    aView->setFrame(0, 0, numCols, numRows);
   }
 }
 
@@ -121,8 +165,8 @@ void PixelPage::postInfo(const string aInfo)
 
 bool PixelPage::isWithinPage(int aX, int aY)
 {
-  if (aX<0 || aX>=PAGE_NUMCOLS) return false;
-  if (aY<0 || aY>=PAGE_NUMROWS) return false;
+  if (aX<0 || aX>=numCols) return false;
+  if (aY<0 || aY>=numRows) return false;
   return true; // within
 }
 
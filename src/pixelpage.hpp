@@ -31,10 +31,9 @@ namespace p44 {
 
   class PixelPage;
 
-  #define PAGE_NUMCOLS 10
-  #define PAGE_NUMROWS 20
-
-  #define PAGE_NUMPIXELS (PAGE_NUMCOLS*PAGE_NUMROWS)
+  // default board geometry (the original pixelboard)
+  #define DEFAULT_NUMCOLS 10
+  #define DEFAULT_NUMROWS 20
 
   enum {
     pagemode_controls1 = 0x01,
@@ -69,16 +68,33 @@ namespace p44 {
     string name;
     PixelPageInfoCB infoCallback;
     bool dirty;
+    int numCols; ///< number of columns of the board
+    int numRows; ///< number of rows of the board
     ViewPtr view; ///< this page's view
+    SimpleCB needUpdateCB; ///< called when the page needs to be stepped or redisplayed
 
   public :
 
-    PixelPage(const string aName, PixelPageInfoCB aInfoCallback);
+    /// create page
+    /// @param aName name of the page
+    /// @param aInfoCallback will be called to deliver events to the application
+    /// @param aNumCols number of columns of the board
+    /// @param aNumRows number of rows of the board
+    PixelPage(const string aName, PixelPageInfoCB aInfoCallback, int aNumCols, int aNumRows);
 
     virtual ~PixelPage();
 
     string getName() { return name; }
 
+    /// @return number of columns of the board
+    int getNumCols() { return numCols; }
+
+    /// @return number of rows of the board
+    int getNumRows() { return numRows; }
+
+    /// @return number of pixels of the board
+    int getNumPixels() { return numCols*numRows; }
+
     /// start showing this page
     /// @param aMode in what mode to show the page (0x01=bottom, 0x02=top, 0x03=both)
     virtual void show(PageMode aMode) = 0;
@@ -91,6 +107,15 @@ namespace p44 {
     /// @note this is called on the active page at least once per mainloop cycle
     virtual bool step();
 
+    /// get time when step() needs to be called next
+    /// @return time of next time based change, Infinite if the page does not need to be stepped until
+    ///   something else (timer, key, API request) changes it, which is reported via the need update handler
+    virtual MLMicroSeconds nextStepTime();
+
+    /// set handler to be called when the page needs to be stepped or redisplayed outside the regular steps
+    /// @param aNeedUpdateCB handler, called when the page or its view becomes dirty or requests a step
+    void setNeedUpdateHandler(SimpleCB aNeedUpdateCB) { needUpdateCB = aNeedUpdateCB; };
+
     /// handle key events
     /// @param aSide which side of the board (0=bottom, 1=top)
     /// @param aNewPressedKeys combined keycodes of keys newly detected pressed in this event.
@@ -113,6 +138,10 @@ namespace p44 {
     /// return if anything changed on the display since last call
     bool isDirty();
 
+    /// get the area changed since last call to updated()
+    /// @return changed area in PlayField coordinates
+    PixelRect getDirtyRect();
+
     /// call when display is updated
     void updated();
 
@@ -132,12 +161,29 @@ namespace p44 {
     /// @param aY PlayField Y coordinate
     virtual PixelColor colorAt(int aX, int aY);
 
+    /// render a horizontal span of pixels
+    /// @param aY PlayField Y coordinate of the span
+    /// @param aX0 PlayField X coordinate of the first pixel of the span
+    /// @param aX1 PlayField X coordinate following the last pixel of the span
+    /// @param aOut buffer to receive aX1-aX0 pixels
+    /// @note default implementation lets the page's view render the span, or uses colorAt() when there is no view
+    virtual void renderSpan(int aY, int aX0, int aX1, PixelColor *aOut);
+
+    /// create a frozen copy of what the page currently shows, for rendering on another thread
+    /// @return a view rendering the same pixels as renderSpan() does now, NULL if the page shows nothing
+    /// @note default implementation returns a snapshot of the page's view. Pages rendering without
+    ///   a view (overriding colorAt()) must override this as well.
+    virtual ViewPtr snapshot();
+
     /// true if coordinate is within display
     bool isWithinPage(int aX, int aY);
 
   protected:
 
-    void makeDirty() { dirty = true; };
+    void makeDirty() { dirty = true; needUpdate(); };
+
+    /// request a call to step() and a display update as soon as possible
+    void needUpdate() { if (needUpdateCB) needUpdateCB(); };
 
     // post info
     void postInfo(const string aInfo);
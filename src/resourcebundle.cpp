@@ -0,0 +1,228 @@
+//
+//  Copyright (c) 2017 plan44.ch / Lukas Zeller, Zurich, Switzerland
+//
+//  Author: Lukas Zeller <luz@plan44.ch>
+//
+//  This file is part of pixelboardd.
+//
+//  pixelboardd is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  pixelboardd is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with pixelboardd. If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#include "resourcebundle.hpp"
+
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <algorithm>
+
+using namespace p44;
+
+
+// MARK: ===== ResourceBundle
+
+ResourceBundle::ResourceBundle() :
+  fd(-1),
+  mapping(NULL),
+  mappingSize(0),
+  header(NULL),
+  entries(NULL)
+{
+}
+
+
+ResourceBundle::~ResourceBundle()
+{
+  close();
+}
+
+
+ResourceBundle &ResourceBundle::sharedBundle()
+{
+  static ResourceBundle bundle;
+  return bundle;
+}
+
+
+ErrorPtr ResourceBundle::open(const string aBundlePath)
+{
+  close();
+  fd = ::open(aBundlePath.c_str(), O_RDONLY);
+  if (fd<0) return SysError::errNo("cannot open resource bundle: ");
+  struct stat st;
+  if (fstat(fd, &st)<0) {
+    ErrorPtr err = SysError::errNo("cannot stat resource bundle: ");
+    close();
+    return err;
+  }
+  mappingSize = st.st_size;
+  if (mappingSize<sizeof(BundleHeader)) {
+    close();
+    return TextError::err("resource bundle %s is too short", aBundlePath.c_str());
+  }
+  mapping = mmap(NULL, mappingSize, PROT_READ, MAP_SHARED, fd, 0);
+  if (mapping==MAP_FAILED) {
+    mapping = NULL;
+    ErrorPtr err = SysError::errNo("cannot map resource bundle: ");
+    close();
+    return err;
+  }
+  header = (const BundleHeader *)mapping;
+  entries = (const BundleEntry *)(header+1);
+  if (
+    memcmp(header->magic, RESOURCE_BUNDLE_MAGIC, sizeof(header->magic))!=0 ||
+    header->pixelSize!=sizeof(PixelColor) ||
+    sizeof(BundleHeader)+header->numEntries*sizeof(BundleEntry)>mappingSize
+  ) {
+    close();
+    return TextError::err("%s is not a valid resource bundle", aBundlePath.c_str());
+  }
+  LOG(LOG_NOTICE, "Resource bundle %s: %d images", aBundlePath.c_str(), header->numEntries);
+  return ErrorPtr();
+}
+
+
+void ResourceBundle::close()
+{
+  if (mapping) {
+    munmap(mapping, mappingSize);
+    mapping = NULL;
+  }
+  if (fd>=0) {
+    ::close(fd);
+    fd = -1;
+  }
+  header = NULL;
+  entries = NULL;
+  mappingSize = 0;
+}
+
+
+DecodedImagePtr ResourceBundle::getImage(const string aResourceName)
+{
+  if (!mapping) return DecodedImagePtr();
+  // binary search in the sorted entry table
+  int lo = 0;
+  int hi = header->numEntries;
+  while (lo<hi) {
+    int mid = (lo+hi)/2;
+    const BundleEntry &e = entries[mid];
+    int c = strncmp(aResourceName.c_str(), e.name, RESOURCE_BUNDLE_NAME_MAX);
+    if (c<0) hi = mid;
+    else if (c>0) lo = mid+1;
+    else {
+      // found
+      if (e.offset+(uint64_t)e.sizeX*e.sizeY*sizeof(PixelColor)>mappingSize) {
+        LOG(LOG_ERR, "Resource bundle entry %s exceeds bundle", aResourceName.c_str());
+        return DecodedImagePtr();
+      }
+      DecodedImagePtr img = DecodedImagePtr(new DecodedImage);
+      img->sizeX = e.sizeX;
+      img->sizeY = e.sizeY;
+      img->pixelData = (const PixelColor *)((const uint8_t *)mapping+e.offset);
+      img->opaque = (e.flags & bundleimage_opaque)!=0;
+      img->binaryAlpha = (e.flags & bundleimage_binaryalpha)!=0;
+      return img;
+    }
+  }
+  return DecodedImagePtr();
+}
+
+
+// MARK: ===== building bundles
+
+static void findPNGs(const string aBasePath, const string aSubPath, std::vector<string> &aNames)
+{
+  DIR *dir = opendir((aBasePath+"/"+aSubPath).c_str());
+  if (!dir) return;
+  struct dirent *de;
+  while ((de = readdir(dir))!=NULL) {
+    string n = de->d_name;
+    if (n[0]=='.') continue; // hidden, . and ..
+    string sub = aSubPath+"/"+n;
+    struct stat st;
+    if (stat((aBasePath+"/"+sub).c_str(), &st)!=0) continue;
+    if (S_ISDIR(st.st_mode)) {
+      findPNGs(aBasePath, sub, aNames);
+    }
+    else if (n.size()>4 && n.substr(n.size()-4)==".png") {
+      aNames.push_back(sub);
+    }
+  }
+  closedir(dir);
+}
+
+
+ErrorPtr ResourceBundle::build(const string aResourcePath, const string aBundlePath, int &aNumImages)
+{
+  aNumImages = 0;
+  std::vector<string> names;
+  findPNGs(aResourcePath, "images", names);
+  std::sort(names.begin(), names.end());
+  // decode all images
+  std::vector<DecodedImagePtr> images;
+  std::vector<BundleEntry> table;
+  uint64_t offset = sizeof(BundleHeader)+names.size()*sizeof(BundleEntry);
+  for (size_t i=0; i<names.size(); i++) {
+    if (names[i].size()>=RESOURCE_BUNDLE_NAME_MAX) {
+      return TextError::err("resource name too long: %s", names[i].c_str());
+    }
+    DecodedImagePtr img = DecodedImagePtr(new DecodedImage);
+    ErrorPtr err = img->loadPNG(aResourcePath+"/"+names[i]);
+    if (!Error::isOK(err)) return err;
+    BundleEntry e;
+    memset(&e, 0, sizeof(e));
+    strncpy(e.name, names[i].c_str(), RESOURCE_BUNDLE_NAME_MAX-1);
+    e.sizeX = img->getSizeX();
+    e.sizeY = img->getSizeY();
+    e.flags = (img->isOpaque() ? bundleimage_opaque : 0) | (img->isBinaryAlpha() ? bundleimage_binaryalpha : 0);
+    e.offset = offset;
+    offset += e.sizeX*e.sizeY*sizeof(PixelColor);
+    offset = (offset+7) & ~7; // keep pixels aligned
+    table.push_back(e);
+    images.push_back(img);
+  }
+  // write bundle to a temporary file first: a running daemon may have the bundle mapped,
+  // truncating it in place would pull the pixels out from under it
+  string tmpPath = aBundlePath+".tmp";
+  FILE *f = fopen(tmpPath.c_str(), "w");
+  if (!f) return SysError::errNo("cannot create resource bundle: ");
+  BundleHeader h;
+  memset(&h, 0, sizeof(h));
+  memcpy(h.magic, RESOURCE_BUNDLE_MAGIC, sizeof(h.magic));
+  h.numEntries = (uint32_t)table.size();
+  h.pixelSize = sizeof(PixelColor);
+  bool ok = fwrite(&h, sizeof(h), 1, f)==1;
+  if (ok && !table.empty()) ok = fwrite(&table[0], sizeof(BundleEntry), table.size(), f)==table.size();
+  for (size_t i=0; ok && i<images.size(); i++) {
+    ok = fseek(f, table[i].offset, SEEK_SET)==0;
+    if (ok) ok = fwrite(images[i]->getPixels(), sizeof(PixelColor), table[i].sizeX*table[i].sizeY, f)==table[i].sizeX*table[i].sizeY;
+  }
+  if (ok) ok = fclose(f)==0;
+  else fclose(f);
+  if (!ok) {
+    ErrorPtr err = SysError::errNo("cannot write resource bundle: ");
+    remove(tmpPath.c_str());
+    return err;
+  }
+  // replace the bundle atomically, existing mappings keep the old file
+  if (rename(tmpPath.c_str(), aBundlePath.c_str())!=0) {
+    ErrorPtr err = SysError::errNo("cannot replace resource bundle: ");
+    remove(tmpPath.c_str());
+    return err;
+  }
+  aNumImages = (int)images.size();
+  return ErrorPtr();
+}
@@ -0,0 +1,105 @@
+//
+//  Copyright (c) 2017 plan44.ch / Lukas Zeller, Zurich, Switzerland
+//
+//  Author: Lukas Zeller <luz@plan44.ch>
+//
+//  This file is part of pixelboardd.
+//
+//  pixelboardd is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  pixelboardd is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with pixelboardd. If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#ifndef __pixelboardd_resourcebundle_hpp__
+#define __pixelboardd_resourcebundle_hpp__
+
+#include "p44utils_common.hpp"
+#include "imagecache.hpp"
+
+namespace p44 {
+
+  #define RESOURCE_BUNDLE_MAGIC "PXBUNDL1"
+  #define RESOURCE_BUNDLE_NAME_MAX 96
+
+  /// bundle file header
+  typedef struct {
+    char magic[8]; ///< RESOURCE_BUNDLE_MAGIC
+    uint32_t numEntries; ///< number of entries in the entry table following the header
+    uint32_t pixelSize; ///< sizeof(PixelColor), to detect bundles built for an incompatible format
+  } BundleHeader;
+
+  enum {
+    bundleimage_opaque = 0x01, ///< all pixels are fully opaque
+    bundleimage_binaryalpha = 0x02 ///< all pixels are either fully opaque or fully transparent
+  };
+
+  /// bundle entry table element, table is sorted by name
+  typedef struct {
+    char name[RESOURCE_BUNDLE_NAME_MAX]; ///< resource name, e.g. "images/main.png", null terminated
+    uint32_t sizeX; ///< image width
+    uint32_t sizeY; ///< image height
+    uint32_t flags; ///< bundleimage_xxx flags
+    uint32_t reserved;
+    uint64_t offset; ///< offset of the pixels from the beginning of the file
+  } BundleEntry;
+
+
+  /// Packed resources, memory mapped. Images are stored decoded, in premultiplied alpha and in content
+  /// coordinates (bottom row first), so they can be shown directly from the mapped file without
+  /// decoding or copying.
+  class ResourceBundle
+  {
+    int fd; ///< the bundle file
+    void *mapping; ///< the mapped file
+    size_t mappingSize; ///< size of the mapped file
+    const BundleHeader *header; ///< header in the mapped file
+    const BundleEntry *entries; ///< entry table in the mapped file
+
+    ResourceBundle();
+    ~ResourceBundle();
+
+  public:
+
+    /// @return the shared resource bundle
+    static ResourceBundle &sharedBundle();
+
+    /// open a resource bundle
+    /// @param aBundlePath the bundle file
+    /// @return ok or error if the bundle cannot be used
+    ErrorPtr open(const string aBundlePath);
+
+    /// close the bundle
+    /// @note images from the bundle must not be in use any more
+    void close();
+
+    /// @return true if a bundle is open
+    bool isOpen() { return mapping!=NULL; };
+
+    /// get an image from the bundle
+    /// @param aResourceName name relative to the resource path, e.g. "images/main.png"
+    /// @return image with pixels directly in the mapped bundle, NULL if the bundle does not contain the image
+    DecodedImagePtr getImage(const string aResourceName);
+
+    /// build a bundle file from all PNG images in a resource folder
+    /// @param aResourcePath the resource folder (the one containing "images")
+    /// @param aBundlePath the bundle file to create
+    /// @param aNumImages will be set to the number of images bundled
+    /// @return ok or error
+    static ErrorPtr build(const string aResourcePath, const string aBundlePath, int &aNumImages);
+
+  };
+
+} // namespace p44
+
+
+#endif /* __pixelboardd_resourcebundle_hpp__ */
@@ -0,0 +1,112 @@
+//
+//  Copyright (c) 2017 plan44.ch / Lukas Zeller, Zurich, Switzerland
+//
+//  Author: Lukas Zeller <luz@plan44.ch>
+//
+//  This file is part of pixelboardd.
+//
+//  pixelboardd is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  pixelboardd is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with pixelboardd. If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#include "stats.hpp"
+
+#include <cmath>
+
+using namespace p44;
+
+
+// MARK: ===== LatencyHistogram
+
+LatencyHistogram::LatencyHistogram()
+{
+  reset();
+}
+
+
+void LatencyHistogram::reset()
+{
+  for (int i=0; i<numBuckets; i++) {
+    buckets[i] = 0;
+  }
+  count = 0;
+  maxUS = 0;
+}
+
+
+void LatencyHistogram::add(MLMicroSeconds aDuration)
+{
+  uint32_t us = aDuration<0 ? 0 : (aDuration>UINT32_MAX ? UINT32_MAX : (uint32_t)aDuration);
+  int b = us==0 ? 0 : 32-__builtin_clz(us);
+  if (b>=numBuckets) b = numBuckets-1;
+  buckets[b].fetch_add(1, std::memory_order_relaxed);
+  count.fetch_add(1, std::memory_order_relaxed);
+  uint32_t m = maxUS.load(std::memory_order_relaxed);
+  while (us>m && !maxUS.compare_exchange_weak(m, us, std::memory_order_relaxed));
+}
+
+
+MLMicroSeconds LatencyHistogram::percentile(double aFraction)
+{
+  uint32_t n = count;
+  if (n==0) return 0;
+  double target = ceil(aFraction*n);
+  if (target<1) target = 1;
+  double below = 0;
+  for (int b=0; b<numBuckets; b++) {
+    uint32_t inBucket = buckets[b];
+    if (inBucket>0 && below+inBucket>=target) {
+      if (b==0) return 0;
+      // interpolate within the bucket's range
+      double lo = 1u<<(b-1);
+      double hi = lo*2;
+      MLMicroSeconds d = lo+(hi-lo)*(target-below)/inBucket;
+      return d<getMax() ? d : getMax();
+    }
+    below += inBucket;
+  }
+  return getMax(); // samples added while scanning
+}
+
+
+JsonObjectPtr LatencyHistogram::json()
+{
+  JsonObjectPtr o = JsonObject::newObj();
+  o->add("count", JsonObject::newInt64(getCount()));
+  o->add("p50", JsonObject::newInt64(percentile(0.5)));
+  o->add("p99", JsonObject::newInt64(percentile(0.99)));
+  o->add("max", JsonObject::newInt64(getMax()));
+  return o;
+}
+
+
+void LatencyHistogram::addFlatFields(JsonObjectPtr aObj, const string aName)
+{
+  aObj->add((aName+"_count").c_str(), JsonObject::newInt64(getCount()));
+  aObj->add((aName+"_p50_us").c_str(), JsonObject::newInt64(percentile(0.5)));
+  aObj->add((aName+"_p99_us").c_str(), JsonObject::newInt64(percentile(0.99)));
+  aObj->add((aName+"_max_us").c_str(), JsonObject::newInt64(getMax()));
+}
+
+
+string LatencyHistogram::text(const string aName)
+{
+  return string_format(
+    "%s_count %u\n%s_p50_us %lld\n%s_p99_us %lld\n%s_max_us %lld\n",
+    aName.c_str(), getCount(),
+    aName.c_str(), (long long)percentile(0.5),
+    aName.c_str(), (long long)percentile(0.99),
+    aName.c_str(), (long long)getMax()
+  );
+}
@@ -0,0 +1,89 @@
+//
+//  Copyright (c) 2017 plan44.ch / Lukas Zeller, Zurich, Switzerland
+//
+//  Author: Lukas Zeller <luz@plan44.ch>
+//
+//  This file is part of pixelboardd.
+//
+//  pixelboardd is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  pixelboardd is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with pixelboardd. If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#ifndef __pixelboardd_stats_hpp__
+#define __pixelboardd_stats_hpp__
+
+#include "p44utils_common.hpp"
+#include "jsonobject.hpp"
+
+#include <atomic>
+
+namespace p44 {
+
+  /// Histogram of durations with log2 sized buckets.
+  /// Recording a sample is a few atomic increments, so it can be fed from any thread
+  /// and be always on.
+  class LatencyHistogram
+  {
+  public:
+
+    enum {
+      numBuckets = 32 ///< bucket 0 counts 0uS, bucket N>0 counts 2^(N-1)..2^N-1 uS
+    };
+
+  private:
+
+    std::atomic<uint32_t> buckets[numBuckets];
+    std::atomic<uint32_t> count; ///< total number of samples
+    std::atomic<uint32_t> maxUS; ///< largest sample in uS
+
+  public:
+
+    LatencyHistogram();
+
+    /// record a sample
+    /// @param aDuration the duration to record (negative durations are recorded as 0)
+    void add(MLMicroSeconds aDuration);
+
+    /// forget all samples
+    void reset();
+
+    /// @return number of samples recorded
+    uint32_t getCount() { return count; };
+
+    /// @return largest sample recorded
+    MLMicroSeconds getMax() { return maxUS; };
+
+    /// estimate a percentile
+    /// @param aFraction the fraction of samples that are smaller or equal (0.5 for the median)
+    /// @return the duration, linearly interpolated within its bucket, 0 if there are no samples
+    MLMicroSeconds percentile(double aFraction);
+
+    /// @return JSON object with count, p50, p99 and max (durations in uS)
+    JsonObjectPtr json();
+
+    /// add count, p50, p99 and max as flat "<name>_<field>" members, named like the text() lines
+    /// @param aObj JSON object to add the fields to
+    /// @param aName prefix for the field names
+    void addFlatFields(JsonObjectPtr aObj, const string aName);
+
+    /// @return count, p50, p99 and max as "<name>_<field> <value>" lines for scraping
+    /// @param aName prefix for the lines
+    string text(const string aName);
+
+  };
+
+} // namespace p44
+
+
+#endif /* __pixelboardd_stats_hpp__ */
@@ -174,7 +174,8 @@ virtual PixelColor colorAt(int aX, int aY) = 0;
 
 TextView::TextView(int aOriginX, int aOriginY, int aWidth, int aOrientation) :
   textPixels(NULL),
-  lastTextStep(Never)
+  lastTextStep(Never),
+  textActive(false)
 {
   // content
   if (aOrientation & xy_swap) {
@@ -185,11 +186,12 @@ TextView::TextView(int aOriginX, int aOriginY, int aWidth, int aOrientation) :
   }
   setContentSize(aWidth, rowsPerGlyph);
   setOrientation(aOrientation);
-  textPixels = new uint8_t[contentSizeX*rowsPerGlyph];
+  textPixels = new uint8_t[contentSizeX*rowsPerGlyph]();
   textColor.r = 200;
   textColor.g = 200;
   textColor.b = 200;
   textColor.a = 255;
+  updateTextColorLevels();
   text_intensity = 255; // intensity of last column of text (where text appears)
   cycles_per_px = 5;
   text_repeats = 15; // text displays until faded down to almost zero
@@ -263,6 +265,7 @@ void TextView::setText(const string aText, bool aScrolling)
     text += c;
     i++;
   }
+  renderTextColumns();
   // initiate display of new text
   scrolling = aScrolling;
   textCycleCount = 0;
@@ -275,22 +278,55 @@ void TextView::setText(const string aText, bool aScrolling)
     // just appears at origin
     textPixelOffset = 0;
   }
+  textActive = true;
+  requestStep();
+}
+
+
+void TextView::renderTextColumns()
+{
+  // glyph offsets are the running sum of glyph widths, so every glyph is copied to its place once,
+  // and step() only needs to pick the visible window of columns
+  int totalTextPixels = 0;
+  int textLen = (int)text.length();
+  for (int i=0; i<textLen; i++) {
+    totalTextPixels += fontGlyphs[glyphIndexForChar(text[i])].width + glyphSpacing;
+  }
+  textColumns.assign(totalTextPixels, 0);
+  int glyphOffset = 0;
+  for (int i=0; i<textLen; i++) {
+    const glyph_t &glyph = fontGlyphs[glyphIndexForChar(text[i])];
+    memcpy(&textColumns[glyphOffset], glyph.cols, glyph.width);
+    glyphOffset += glyph.width + glyphSpacing; // spacing columns remain empty
+  }
+}
+
+
+void TextView::updateTextColorLevels()
+{
+  PixelColor pc = textColor;
+  for (int i=0; i<256; i++) {
+    pc.a = i;
+    textColorLevels[i] = premultipliedPixel(pc);
+  }
 }
 
 
 void TextView::setTextColor(PixelColor aTextColor)
 {
   textColor = aTextColor; // alpha of textColor is not used
+  updateTextColorLevels();
   setAlpha(aTextColor.a); // put it into overall layer alpha instead
+  makeDirty();
 }
 
 
 bool TextView::step()
 {
-  MLMicroSeconds now = MainLoop::now();
-  if (lastTextStep+textStepTime<now) {
+  MLMicroSeconds now = BoardClock::now();
+  if (lastTextStep+textStepTime<=now) {
     lastTextStep = now;
-    makeDirty(); // things will change
+    prevTextPixels.assign(textPixels, textPixels+contentSizeX*rowsPerGlyph);
     // fade between rows
     uint8_t maxBright = text_intensity-repeatCount*fade_per_repeat;
     uint8_t thisBright, nextBright;
@@ -302,43 +338,13 @@ bool TextView::step()
       nextBright = 0;
     }
     // generate vertical rows
-    int activeCols = contentSizeX;
-    // calculate text length in pixels
-    int totalTextPixels = 0;
-    int textLen = (int)text.length();
-    for (int i=0; i<textLen; i++) {
-      // sum up width of individual chars
-      totalTextPixels += fontGlyphs[glyphIndexForChar(text[i])].width + glyphSpacing;
-    }
+    int totalTextPixels = (int)textColumns.size();
     for (int x=0; x<contentSizeX; x++) {
+      // pick font column from the pre-rendered text
       uint8_t column = 0;
-      // determine font column
-      if (x<activeCols) {
-        int colPixelOffset = textPixelOffset + x;
-        if (colPixelOffset>=0) {
-          // visible column
-          // - calculate character index
-          int charIndex = 0;
-          int glyphOffset = colPixelOffset;
-          const glyph_t *glyphP = NULL;
-          while (charIndex<textLen) {
-            glyphP = &fontGlyphs[glyphIndexForChar(text[charIndex])];
-            int cw = glyphP->width + glyphSpacing;
-            if (glyphOffset<cw) break; // found char
-            glyphOffset -= cw;
-            charIndex++;
-          }
-          // now we have
-          // - glyphP = the glyph,
-          // - glyphOffset=column offset within that glyph (but might address a spacing column not stored in font table)
-          if (charIndex<textLen) {
-            // is a column of a visible char
-            if (glyphOffset<glyphP->width) {
-              // fetch glyph column
-              column = glyphP->cols[glyphOffset];
-            }
-          }
-        }
+      int colPixelOffset = textPixelOffset + x;
+      if (colPixelOffset>=0 && colPixelOffset<totalTextPixels) {
+        column = textColumns[colPixelOffset];
       }
       // now render columns
       for (int glyphRow=0; glyphRow<rowsPerGlyph; glyphRow++) {
@@ -359,6 +365,21 @@ bool TextView::step()
         textPixels[i] = 0; // no text
       }
     }
+    // report changed columns only
+    PixelRect changed = zeroRect;
+    for (int x=0; x<contentSizeX; x++) {
+      for (int glyphRow=0; glyphRow<rowsPerGlyph; glyphRow++) {
+        int i = glyphRow*contentSizeX + x;
+        if (textPixels[i]!=prevTextPixels[i]) {
+          PixelRect col = { .x=x, .y=0, .dx=1, .dy=rowsPerGlyph };
+          rectUnion(changed, col);
+          break;
+        }
+      }
+    }
+    makeContentDirty(changed);
+    // a step that did not change anything after the text has ended means the display is clear
+    textActive = !text.empty() || !rectEmpty(changed);
     // increment
     textCycleCount++;
     if (scrolling) {
@@ -371,6 +392,7 @@ bool TextView::step()
           if (text_repeats!=0 && repeatCount>=text_repeats) {
             // done
             text = ""; // remove text
+            textColumns.clear();
           }
           else {
             // show again
@@ -386,6 +408,7 @@ bool TextView::step()
         if (text_repeats!=0 && repeatCount>=text_repeats) {
           // done
           text = ""; // remove text
+          textColumns.clear();
         }
       }
     }
@@ -394,15 +417,49 @@ bool TextView::step()
 }
 
 
+MLMicroSeconds TextView::nextStepTime()
+{
+  MLMicroSeconds next = inherited::nextStepTime();
+  if (textActive && lastTextStep+textStepTime<next) {
+    next = lastTextStep+textStepTime;
+  }
+  return next;
+}
+
+
+ViewPtr TextView::snapshot()
+{
+  TextViewPtr s = TextViewPtr(new TextView(originX, originY, contentSizeX, contentOrientation));
+  s->copyViewState(*this);
+  memcpy(s->textPixels, textPixels, contentSizeX*rowsPerGlyph);
+  memcpy(s->textColorLevels, textColorLevels, sizeof(textColorLevels));
+  s->text = text; // for isAnimating()
+  return s;
+}
+
+
 PixelColor TextView::contentColorAt(int aX, int aY)
 {
   if (aX<0 || aX>=contentSizeX || aY<0 || aY>=rowsPerGlyph) {
     return inherited::contentColorAt(aX, aY);
   }
   else {
-    PixelColor pc = textColor;
-    pc.a = textPixels[aY*contentSizeX + aX]; // brightness of pixel
-    return pc;
+    return textColorLevels[textPixels[aY*contentSizeX + aX]]; // brightness of pixel
+  }
+}
+
+
+void TextView::contentSpan(int aX, int aY, int aDx, int aDy, int aNum, PixelColor *aOut)
+{
+  for (int i=0; i<aNum; i++) {
+    if (aX<0 || aX>=contentSizeX || aY<0 || aY>=rowsPerGlyph) {
+      aOut[i] = backgroundColor;
+    }
+    else {
+      aOut[i] = textColorLevels[textPixels[aY*contentSizeX + aX]]; // brightness of pixel
+    }
+    aX += aDx;
+    aY += aDy;
   }
 }
 
@@ -41,15 +41,19 @@ namespace p44 {
     uint8_t fade_base; // crossfading base brightness level
     bool mirrorText;
     PixelColor textColor;
+    PixelColor textColorLevels[256]; ///< premultiplied text color for each text pixel brightness
     MLMicroSeconds textStepTime = 0.02*Second;
 
     // text rendering
     string text; ///< internal representation of text
+    std::vector<uint8_t> textColumns; ///< entire text pre-rendered, one glyph column bitmask per pixel column, including spacing
     uint8_t *textPixels;
+    std::vector<uint8_t> prevTextPixels; ///< text pixels before current step, to detect changed columns
     int textPixelOffset;
     int textCycleCount;
     int repeatCount;
     MLMicroSeconds lastTextStep;
+    bool textActive; ///< set while text is shown or still needs to be cleared from the display
 
   public :
 
@@ -64,20 +68,35 @@ namespace p44 {
     /// @note this is called on the active page at least once per mainloop cycle
     virtual bool step();
 
+    /// get time when step() needs to be called next
+    /// @return time of next text rendering step, Infinite if no text is active
+    virtual MLMicroSeconds nextStepTime();
+
     /// set new text
     void setText(const string aText, bool aScrolling = true);
 
     /// set new text color
     void setTextColor(PixelColor aTextColor);
 
+    /// return if view is currently animating (displaying text)
+    virtual bool isAnimating() { return inherited::isAnimating() || !text.empty(); };
+
+    /// create a frozen copy of this view showing the current text pixels
+    virtual ViewPtr snapshot();
+
   protected:
 
     /// get content color at X,Y
     virtual PixelColor contentColorAt(int aX, int aY);
 
+    /// get a run of content pixel colors directly from the text pixels
+    virtual void contentSpan(int aX, int aY, int aDx, int aDy, int aNum, PixelColor *aOut);
+
   private:
 
+    void renderTextColumns();
     void crossFade(uint8_t aFader, uint8_t aValue, uint8_t &aOutputA, uint8_t &aOutputB);
+    void updateTextColorLevels();
 
   };
   typedef boost::intrusive_ptr<TextView> TextViewPtr;
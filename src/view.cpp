@@ -21,11 +21,24 @@
 
 #include "view.hpp"
 
+#if defined(__AVX2__) || defined(__SSE2__)
+  #include <immintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+  #include <arm_neon.h>
+#endif
+
 using namespace p44;
 
 // MARK: ===== View
 
-View::View()
+View::View() :
+  dirtyRect(zeroRect),
+  updateCount(0),
+  parentView(NULL),
+  originX(0),
+  originY(0),
+  dX(0),
+  dY(0)
 {
   setFrame(0, 0, 0, 0);
   // default to normal orientation
@@ -61,11 +74,112 @@ bool View::isInContentSize(int aX, int aY)
 
 void View::setFrame(int aOriginX, int aOriginY, int aSizeX, int aSizeY)
 {
+  makeDirty(); // area of the old frame
   originX = aOriginX;
   originY = aOriginY;
   dX = aSizeX,
   dY = aSizeY;
   makeDirty();
+  makeGeometryDirty();
+}
+
+
+void View::makeDirty()
+{
+  makeFrameRectDirty(getFrame());
+}
+
+
+PixelRect View::contentToFrameRect(PixelRect aRect)
+{
+  if (rectEmpty(aRect)) return zeroRect;
+  // transform two opposite corners back into frame coordinates
+  int x[2] = { aRect.x, aRect.x+aRect.dx-1 };
+  int y[2] = { aRect.y, aRect.y+aRect.dy-1 };
+  for (int i=0; i<2; i++) {
+    if (contentOrientation & y_flip) {
+      y[i] = contentSizeY-y[i]-1;
+    }
+    if (contentOrientation & x_flip) {
+      x[i] = contentSizeX-x[i]-1;
+    }
+    if (contentOrientation & xy_swap) {
+      swap(x[i], y[i]);
+    }
+    x[i] += originX+offsetX;
+    y[i] += originY+offsetY;
+  }
+  PixelRect r;
+  r.x = min(x[0], x[1]);
+  r.y = min(y[0], y[1]);
+  r.dx = max(x[0], x[1])-r.x+1;
+  r.dy = max(y[0], y[1])-r.y+1;
+  return r;
+}
+
+
+void View::makeContentDirty(PixelRect aRect)
+{
+  makeFrameRectDirty(contentToFrameRect(aRect));
+}
+
+
+void View::makeFrameRectDirty(PixelRect aRect)
+{
+  if (rectEmpty(aRect)) return;
+  rectUnion(dirtyRect, aRect);
+  // propagate upwards
+  if (parentView) {
+    parentView->childDirty(this, aRect);
+  }
+  else if (needUpdateCB) {
+    needUpdateCB();
+  }
+}
+
+
+void View::requestStep()
+{
+  View *v = this;
+  while (v->parentView) v = v->parentView;
+  if (v->needUpdateCB) v->needUpdateCB();
+}
+
+
+void View::copyViewState(const View &aView)
+{
+  dirtyRect = aView.dirtyRect;
+  updateCount = aView.updateCount;
+  targetAlpha = aView.targetAlpha;
+  fadeDist = aView.fadeDist;
+  startTime = aView.startTime;
+  fadeTime = aView.fadeTime;
+  originX = aView.originX;
+  originY = aView.originY;
+  dX = aView.dX;
+  dY = aView.dY;
+  alpha = aView.alpha;
+  backgroundColor = aView.backgroundColor;
+  offsetX = aView.offsetX;
+  offsetY = aView.offsetY;
+  contentOrientation = aView.contentOrientation;
+  contentSizeX = aView.contentSizeX;
+  contentSizeY = aView.contentSizeY;
+}
+
+
+ViewPtr View::snapshot()
+{
+  ViewPtr s = ViewPtr(new View);
+  s->copyViewState(*this);
+  return s;
+}
+
+
+void View::childDirty(View *aChild, PixelRect aRect)
+{
+  // subview's frame coordinates are my content coordinates
+  makeContentDirty(aRect);
 }
 
 
@@ -73,7 +187,7 @@ bool View::step()
 {
   // check fading
   if (targetAlpha>=0) {
-    double timeDone = (double)(MainLoop::now()-startTime)/fadeTime;
+    double timeDone = (double)(BoardClock::now()-startTime)/fadeTime;
     if (timeDone<1) {
       // continue fading
       int currentAlpha = targetAlpha-(1-timeDone)*fadeDist;
@@ -95,11 +209,24 @@ bool View::step()
 }
 
 
+MLMicroSeconds View::nextStepTime()
+{
+  if (targetAlpha<0) return Infinite; // not fading
+  // alpha changes by one step every fadeTime/fadeDist
+  MLMicroSeconds next = BoardClock::now()+fadeTime/abs(fadeDist);
+  MLMicroSeconds end = startTime+fadeTime;
+  return next<end ? next : end;
+}
+
+
 void View::setAlpha(int aAlpha)
 {
   if (alpha!=aAlpha) {
+    // only fully opaque view stacks can be flattened into their parent's render list
+    bool opaqueChanged = (alpha==255)!=(aAlpha==255);
     alpha = aAlpha;
     makeDirty();
+    if (opaqueChanged) makeGeometryDirty();
   }
 }
 
@@ -114,7 +241,7 @@ void View::stopFading()
 void View::fadeTo(int aAlpha, MLMicroSeconds aWithIn, SimpleCB aCompletedCB)
 {
   fadeDist = aAlpha-alpha;
-  startTime = MainLoop::now();
+  startTime = BoardClock::now();
   fadeTime = aWithIn;
   if (fadeTime<=0 || fadeDist==0) {
     // immediate
@@ -126,6 +253,7 @@ void View::fadeTo(int aAlpha, MLMicroSeconds aWithIn, SimpleCB aCompletedCB)
     // start fading
     targetAlpha = aAlpha;
     fadeCompleteCB = aCompletedCB;
+    requestStep();
   }
 }
 
@@ -140,29 +268,91 @@ void View::setFullFrameContent()
 
 
 
+void View::toContentCoords(int &aX, int &aY, int &aDx, int &aDy)
+{
+  // calculate coordinate relative to the content's origin
+  aX -= originX+offsetX;
+  aY -= originY+offsetY;
+  // translate into content coordinates
+  if (contentOrientation & xy_swap) {
+    swap(aX, aY);
+    swap(aDx, aDy);
+  }
+  if (contentOrientation & x_flip) {
+    aX = contentSizeX-aX-1;
+    aDx = -aDx;
+  }
+  if (contentOrientation & y_flip) {
+    aY = contentSizeY-aY-1;
+    aDy = -aDy;
+  }
+}
+
+
+PixelTransform View::contentTransform()
+{
+  PixelTransform t = identityTransform;
+  t.x0 = -(originX+offsetX);
+  t.y0 = -(originY+offsetY);
+  if (contentOrientation & xy_swap) {
+    swap(t.xx, t.yx);
+    swap(t.xy, t.yy);
+    swap(t.x0, t.y0);
+  }
+  if (contentOrientation & x_flip) {
+    t.xx = -t.xx;
+    t.xy = -t.xy;
+    t.x0 = contentSizeX-t.x0-1;
+  }
+  if (contentOrientation & y_flip) {
+    t.yx = -t.yx;
+    t.yy = -t.yy;
+    t.y0 = contentSizeY-t.y0-1;
+  }
+  return t;
+}
+
+
+void View::finishSpan(PixelColor *aOut, int aNum)
+{
+  for (int i=0; i<aNum; i++) {
+    if (aOut[i].a==0) {
+      aOut[i] = backgroundColor;
+    }
+    if (alpha!=255) {
+      aOut[i] = dimPremultipliedPixel(aOut[i], alpha);
+    }
+  }
+}
+
+
+void View::contentSpan(int aX, int aY, int aDx, int aDy, int aNum, PixelColor *aOut)
+{
+  for (int i=0; i<aNum; i++) {
+    aOut[i] = contentColorAt(aX, aY);
+    aX += aDx;
+    aY += aDy;
+  }
+}
+
+
+
 #define SHOW_ORIGIN 0
 
 PixelColor View::colorAt(int aX, int aY)
 {
   // default is background color
   PixelColor pc = backgroundColor;
-  if (alpha==0) {
-    pc.a = 0; // entire view is invisible
+  if (alpha==0 || !isInFrame(aX, aY)) {
+    pc = transparent; // entire view is invisible, or pixel is outside the view's frame
   }
   else {
-    // calculate coordinate relative to the content's origin
-    int x = aX-originX-offsetX;
-    int y = aY-originY-offsetY;
     // translate into content coordinates
-    if (contentOrientation & xy_swap) {
-      swap(x, y);
-    }
-    if (contentOrientation & x_flip) {
-      x = contentSizeX-x-1;
-    }
-    if (contentOrientation & y_flip) {
-      y = contentSizeY-y-1;
-    }
+    int x = aX;
+    int y = aY;
+    int dx = 0;
+    int dy = 0;
+    toContentCoords(x, y, dx, dy);
     // NOT limited to content size, content must restrict this!
     pc = contentColorAt(x, y);
     #if SHOW_ORIGIN
@@ -184,13 +374,42 @@ PixelColor View::colorAt(int aX, int aY)
     }
     // factor in layer alpha
     if (alpha!=255) {
-      pc.a = dimVal(pc.a, alpha);
+      pc = dimPremultipliedPixel(pc, alpha);
     }
   }
   return pc;
 }
 
 
+void View::renderSpan(int aY, int aX0, int aX1, PixelColor *aOut)
+{
+  int n = aX1-aX0;
+  if (n<=0) return;
+  // clip span to frame
+  int x0 = max(aX0, originX);
+  int x1 = min(aX1, originX+dX);
+  if (alpha==0 || aY<originY || aY>=originY+dY || x0>=x1) {
+    // entire view is invisible, or span is entirely outside the frame
+    for (int i=0; i<n; i++) aOut[i] = transparent;
+    return;
+  }
+  for (int i=0; i<x0-aX0; i++) aOut[i] = transparent;
+  for (int i=x1-aX0; i<n; i++) aOut[i] = transparent;
+  aOut += x0-aX0;
+  n = x1-x0;
+  // translate start of span and direction into content coordinates
+  int x = x0;
+  int y = aY;
+  int dx = 1;
+  int dy = 0;
+  toContentCoords(x, y, dx, dy);
+  // get content pixels
+  contentSpan(x, y, dx, dy, n, aOut);
+  // apply background and layer alpha (same as in colorAt())
+  finishSpan(aOut, n);
+}
+
+
 // MARK: ===== Utilities
 
 uint8_t p44::dimVal(uint8_t aVal, uint8_t aDim)
@@ -210,6 +429,24 @@ PixelColor p44::dimPixel(const PixelColor aPix, uint8_t aDim)
 }
 
 
+PixelColor p44::dimPremultipliedPixel(const PixelColor aPix, uint8_t aDim)
+{
+  PixelColor pix;
+  pix.r = dimVal(aPix.r, aDim);
+  pix.g = dimVal(aPix.g, aDim);
+  pix.b = dimVal(aPix.b, aDim);
+  pix.a = dimVal(aPix.a, aDim);
+  return pix;
+}
+
+
+PixelColor p44::premultipliedPixel(const PixelColor aPix)
+{
+  if (aPix.a==255) return aPix;
+  return dimPixel(aPix, aPix.a);
+}
+
+
 void p44::reduce(uint8_t &aByte, uint8_t aAmount, uint8_t aMin)
 {
   int r = aByte-aAmount;
@@ -239,15 +476,186 @@ void p44::overlayPixel(PixelColor &aPixel, PixelColor aOverlay)
     // mix in
     // - reduce original by alpha of overlay
     aPixel = dimPixel(aPixel, 255-aOverlay.a);
-    // - reduce overlay by its own alpha
-    aOverlay = dimPixel(aOverlay, aOverlay.a);
-    // - add in
+    // - add in (overlay is already premultiplied)
     addToPixel(aPixel, aOverlay);
   }
   aPixel.a = 255; // result is never transparent
 }
 
 
+// MARK: ===== Span blending
+
+void p44::blendSpanUnderScalar(PixelColor *aAccu, const PixelColor *aLayer, int aNum)
+{
+  for (int i=0; i<aNum; i++) {
+    // layer is premultiplied, so just scale down to seethrough budget left and add in
+    uint8_t s = aAccu[i].a;
+    aAccu[i].r += dimVal(aLayer[i].r, s);
+    aAccu[i].g += dimVal(aLayer[i].g, s);
+    aAccu[i].b += dimVal(aLayer[i].b, s);
+    aAccu[i].a = s-dimVal(aLayer[i].a, s);
+  }
+}
+
+
+#if defined(__SSE2__)
+
+// 16-bit lane helpers: each 128 bit register holds two unpacked RGBA pixels
+
+static inline __m128i alphaBroadcast(__m128i aPix16)
+{
+  return _mm_shufflehi_epi16(_mm_shufflelo_epi16(aPix16, 0xFF), 0xFF);
+}
+
+
+static inline __m128i blendUnder16(__m128i aAccu16, __m128i aLayer16)
+{
+  const __m128i one = _mm_set1_epi16(1);
+  const __m128i lowByte = _mm_set1_epi16(0xFF);
+  const __m128i alphaLanes = _mm_set_epi16(-1,0,0,0,-1,0,0,0);
+  // all channels: dimVal(layer, seethrough)
+  __m128i d = _mm_srli_epi16(_mm_mullo_epi16(aLayer16, _mm_add_epi16(alphaBroadcast(aAccu16), one)), 8);
+  // color = accu + d, wrapping like 8-bit addition
+  __m128i col = _mm_and_si128(_mm_add_epi16(aAccu16, d), lowByte);
+  // seethrough = seethrough - d
+  __m128i see = _mm_sub_epi16(aAccu16, d);
+  return _mm_or_si128(_mm_and_si128(alphaLanes, see), _mm_andnot_si128(alphaLanes, col));
+}
+
+#endif // __SSE2__
+
+#if defined(__AVX2__)
+
+static inline __m256i alphaBroadcast256(__m256i aPix16)
+{
+  return _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(aPix16, 0xFF), 0xFF);
+}
+
+
+static inline __m256i blendUnder16x256(__m256i aAccu16, __m256i aLayer16)
+{
+  const __m256i one = _mm256_set1_epi16(1);
+  const __m256i lowByte = _mm256_set1_epi16(0xFF);
+  const __m256i alphaLanes = _mm256_set_epi16(-1,0,0,0,-1,0,0,0,-1,0,0,0,-1,0,0,0);
+  __m256i d = _mm256_srli_epi16(_mm256_mullo_epi16(aLayer16, _mm256_add_epi16(alphaBroadcast256(aAccu16), one)), 8);
+  __m256i col = _mm256_and_si256(_mm256_add_epi16(aAccu16, d), lowByte);
+  __m256i see = _mm256_sub_epi16(aAccu16, d);
+  return _mm256_or_si256(_mm256_and_si256(alphaLanes, see), _mm256_andnot_si256(alphaLanes, col));
+}
+
+#endif // __AVX2__
+
+
+void p44::blendSpanUnder(PixelColor *aAccu, const PixelColor *aLayer, int aNum)
+{
+  int i = 0;
+  #if defined(__AVX2__)
+  // 8 pixels at a time
+  const __m256i zero256 = _mm256_setzero_si256();
+  for (; i+8<=aNum; i+=8) {
+    __m256i accu = _mm256_loadu_si256((const __m256i *)(aAccu+i));
+    __m256i layer = _mm256_loadu_si256((const __m256i *)(aLayer+i));
+    __m256i lo = blendUnder16x256(_mm256_unpacklo_epi8(accu, zero256), _mm256_unpacklo_epi8(layer, zero256));
+    __m256i hi = blendUnder16x256(_mm256_unpackhi_epi8(accu, zero256), _mm256_unpackhi_epi8(layer, zero256));
+    _mm256_storeu_si256((__m256i *)(aAccu+i), _mm256_packus_epi16(lo, hi));
+  }
+  #endif
+  #if defined(__SSE2__)
+  // 4 pixels at a time
+  const __m128i zero = _mm_setzero_si128();
+  for (; i+4<=aNum; i+=4) {
+    __m128i accu = _mm_loadu_si128((const __m128i *)(aAccu+i));
+    __m128i layer = _mm_loadu_si128((const __m128i *)(aLayer+i));
+    __m128i lo = blendUnder16(_mm_unpacklo_epi8(accu, zero), _mm_unpacklo_epi8(layer, zero));
+    __m128i hi = blendUnder16(_mm_unpackhi_epi8(accu, zero), _mm_unpackhi_epi8(layer, zero));
+    _mm_storeu_si128((__m128i *)(aAccu+i), _mm_packus_epi16(lo, hi));
+  }
+  #elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+  // 8 pixels at a time, deinterleaved into channels
+  const uint16x8_t one = vdupq_n_u16(1);
+  for (; i+8<=aNum; i+=8) {
+    uint8x8x4_t accu = vld4_u8((const uint8_t *)(aAccu+i));
+    uint8x8x4_t layer = vld4_u8((const uint8_t *)(aLayer+i));
+    uint16x8_t s1 = vaddw_u8(one, accu.val[3]);
+    for (int c=0; c<3; c++) {
+      accu.val[c] = vadd_u8(accu.val[c], vshrn_n_u16(vmulq_u16(vmovl_u8(layer.val[c]), s1), 8));
+    }
+    accu.val[3] = vsub_u8(accu.val[3], vshrn_n_u16(vmulq_u16(vmovl_u8(layer.val[3]), s1), 8));
+    vst4_u8((uint8_t *)(aAccu+i), accu);
+  }
+  #endif
+  // rest (or all, if no vector unit)
+  blendSpanUnderScalar(aAccu+i, aLayer+i, aNum-i);
+}
+
+
+bool p44::rectEmpty(const PixelRect &aRect)
+{
+  return aRect.dx<=0 || aRect.dy<=0;
+}
+
+
+void p44::rectUnion(PixelRect &aRect, const PixelRect &aOther)
+{
+  if (rectEmpty(aOther)) return;
+  if (rectEmpty(aRect)) {
+    aRect = aOther;
+    return;
+  }
+  int x1 = max(aRect.x+aRect.dx, aOther.x+aOther.dx);
+  int y1 = max(aRect.y+aRect.dy, aOther.y+aOther.dy);
+  aRect.x = min(aRect.x, aOther.x);
+  aRect.y = min(aRect.y, aOther.y);
+  aRect.dx = x1-aRect.x;
+  aRect.dy = y1-aRect.y;
+}
+
+
+void p44::rectIntersect(PixelRect &aRect, const PixelRect &aOther)
+{
+  int x1 = min(aRect.x+aRect.dx, aOther.x+aOther.dx);
+  int y1 = min(aRect.y+aRect.dy, aOther.y+aOther.dy);
+  aRect.x = max(aRect.x, aOther.x);
+  aRect.y = max(aRect.y, aOther.y);
+  aRect.dx = x1-aRect.x;
+  aRect.dy = y1-aRect.y;
+  if (rectEmpty(aRect)) aRect = zeroRect;
+}
+
+
+PixelTransform p44::transformConcat(const PixelTransform &aFirst, const PixelTransform &aThen)
+{
+  PixelTransform t;
+  t.xx = aThen.xx*aFirst.xx + aThen.xy*aFirst.yx;
+  t.xy = aThen.xx*aFirst.xy + aThen.xy*aFirst.yy;
+  t.x0 = aThen.xx*aFirst.x0 + aThen.xy*aFirst.y0 + aThen.x0;
+  t.yx = aThen.yx*aFirst.xx + aThen.yy*aFirst.yx;
+  t.yy = aThen.yx*aFirst.xy + aThen.yy*aFirst.yy;
+  t.y0 = aThen.yx*aFirst.x0 + aThen.yy*aFirst.y0 + aThen.y0;
+  return t;
+}
+
+
+PixelRect p44::transformRectInverse(const PixelTransform &aTransform, const PixelRect &aRect)
+{
+  if (rectEmpty(aRect)) return zeroRect;
+  // matrix only consists of swaps and flips, so inverse is the transposed matrix
+  int x[2] = { aRect.x-aTransform.x0, aRect.x+aRect.dx-1-aTransform.x0 };
+  int y[2] = { aRect.y-aTransform.y0, aRect.y+aRect.dy-1-aTransform.y0 };
+  int sx[2], sy[2];
+  for (int i=0; i<2; i++) {
+    sx[i] = aTransform.xx*x[i] + aTransform.yx*y[i];
+    sy[i] = aTransform.xy*x[i] + aTransform.yy*y[i];
+  }
+  PixelRect r;
+  r.x = min(sx[0], sx[1]);
+  r.y = min(sy[0], sy[1]);
+  r.dx = max(sx[0], sx[1])-r.x+1;
+  r.dy = max(sy[0], sy[1])-r.y+1;
+  return r;
+}
+
+
 void p44::addToPixel(PixelColor &aPixel, PixelColor aIncrease)
 {
   aPixel.r += aIncrease.r;
@@ -23,10 +23,16 @@
 #define __pixelboardd_view_hpp__
 
 #include "p44utils_common.hpp"
+#include "boardclock.hpp"
+
+#include <algorithm>
 
 namespace p44 {
 
 
+  /// RGBA pixel
+  /// @note all colors rendered by views (colorAt(), renderSpan()) are in premultiplied alpha format,
+  ///   i.e. r,g,b are already scaled by a. Composited over black, r,g,b are directly the LED output.
   typedef struct {
     uint8_t r;
     uint8_t g;
@@ -37,19 +43,61 @@ namespace p44 {
   const PixelColor transparent = { .r=0, .g=0, .b=0, .a=0 };
   const PixelColor black = { .r=0, .g=0, .b=0, .a=255 };
 
+  typedef struct {
+    int x;
+    int y;
+    int dx;
+    int dy;
+  } PixelRect;
+
+  const PixelRect zeroRect = { .x=0, .y=0, .dx=0, .dy=0 };
+
+  /// integer coordinate transformation (translation plus any combination of xy_swap, x_flip, y_flip)
+  /// tx = xx*x + xy*y + x0, ty = yx*x + yy*y + y0
+  typedef struct {
+    int xx, xy, x0;
+    int yx, yy, y0;
+  } PixelTransform;
+
+  const PixelTransform identityTransform = { .xx=1, .xy=0, .x0=0, .yx=0, .yy=1, .y0=0 };
+
   /// Utilities
   uint8_t dimVal(uint8_t aVal, uint8_t aDim);
   PixelColor dimPixel(const PixelColor aPix, uint8_t aDim);
+  PixelColor dimPremultipliedPixel(const PixelColor aPix, uint8_t aDim); ///< dims all channels including alpha
+  PixelColor premultipliedPixel(const PixelColor aPix); ///< convert straight alpha to premultiplied alpha
   void reduce(uint8_t &aByte, uint8_t aAmount, uint8_t aMin = 0);
   void increase(uint8_t &aByte, uint8_t aAmount, uint8_t aMax = 255);
   void addToPixel(PixelColor &aPixel, PixelColor aIncrease);
-  void overlayPixel(PixelColor &aPixel, PixelColor aOverlay);
+  void overlayPixel(PixelColor &aPixel, PixelColor aOverlay); ///< aOverlay must be premultiplied
+
+  /// blend a span of layer pixels underneath already accumulated pixels (front-to-back compositing)
+  /// @param aAccu accumulated pixels. The alpha channel is used to hold the amount of seethrough left
+  ///   (start with 255 = nothing accumulated yet, 0 = no more layers below can be seen).
+  /// @param aLayer the layer's pixels (premultiplied) to blend in below aAccu
+  /// @param aNum number of pixels
+  /// @note uses SSE2/AVX2 or NEON when available at build time, results are identical to the scalar version
+  void blendSpanUnder(PixelColor *aAccu, const PixelColor *aLayer, int aNum);
+
+  /// scalar reference version of blendSpanUnder()
+  void blendSpanUnderScalar(PixelColor *aAccu, const PixelColor *aLayer, int aNum);
+  bool rectEmpty(const PixelRect &aRect);
+  void rectUnion(PixelRect &aRect, const PixelRect &aOther);
+  void rectIntersect(PixelRect &aRect, const PixelRect &aOther);
+  PixelTransform transformConcat(const PixelTransform &aFirst, const PixelTransform &aThen); ///< transform applying aFirst, then aThen
+  PixelRect transformRectInverse(const PixelTransform &aTransform, const PixelRect &aRect); ///< map rect from target back to source coordinates
+
+  class View;
+  typedef boost::intrusive_ptr<View> ViewPtr;
 
   class View : public P44Obj
   {
     friend class ViewStack;
+    friend class ViewAnimator;
 
-    bool dirty;
+    PixelRect dirtyRect; ///< changed area since last update (in frame coordinates)
+    long updateCount; ///< number of calls to updated() that cleared changes, to tell if changes were seen by a render pass
+    View *parentView; ///< the view this view is a subview of (to report changes to), NULL if none
 
     /// fading
     int targetAlpha; ///< alpha to reach at end of fading, -1 = not fading
@@ -58,6 +106,8 @@ namespace p44 {
     MLMicroSeconds fadeTime; ///< how long fading takes
     SimpleCB fadeCompleteCB; ///< fade complete
 
+    SimpleCB needUpdateCB; ///< called when this view has no parent and needs to be stepped or redisplayed
+
   public:
 
     // Orientation
@@ -86,7 +136,7 @@ namespace p44 {
     uint8_t alpha;
 
     // background
-    PixelColor backgroundColor;
+    PixelColor backgroundColor; ///< premultiplied
 
     // content
     int offsetX; ///< content X offset (in view coordinates)
@@ -102,11 +152,74 @@ namespace p44 {
     ///   implementation must check this!
     virtual PixelColor contentColorAt(int aX, int aY) { return backgroundColor; }
 
+    /// get a run of content pixel colors
+    /// @param aX content X coordinate of the first pixel
+    /// @param aY content Y coordinate of the first pixel
+    /// @param aDx X increment (in content coordinates) from one pixel to the next
+    /// @param aDy Y increment (in content coordinates) from one pixel to the next
+    /// @param aNum number of pixels to get
+    /// @param aOut buffer to receive aNum pixels
+    /// @note default implementation calls contentColorAt() for every pixel,
+    ///   subclasses should override this with a native implementation avoiding per-pixel virtual calls.
+    /// @note as with contentColorAt(), pixels are NOT guaranteed to be within actual content
+    virtual void contentSpan(int aX, int aY, int aDx, int aDy, int aNum, PixelColor *aOut);
+
+    /// helper for implementations: transform PlayField coordinates into content coordinates
+    /// @param aX on input: PlayField X coordinate, on output: content X coordinate
+    /// @param aY on input: PlayField Y coordinate, on output: content Y coordinate
+    /// @param aDx on input: PlayField X direction, on output: corresponding content X direction
+    /// @param aDy on input: PlayField Y direction, on output: corresponding content Y direction
+    void toContentCoords(int &aX, int &aY, int &aDx, int &aDy);
+
+    /// helper for implementations: get the transformation from PlayField (frame) into content coordinates
+    /// @return transformation doing the same as toContentCoords()
+    PixelTransform contentTransform();
+
+    /// helper for implementations: apply background and layer alpha to content pixels
+    /// @param aOut content pixels as obtained from contentSpan(), will be converted into view pixels
+    /// @param aNum number of pixels
+    void finishSpan(PixelColor *aOut, int aNum);
+
     /// helper for implementations: check if aX/aY within set content size
     bool isInContentSize(int aX, int aY);
 
     /// set dirty - to be called by step() implementation when the view needs to be redisplayed
-    void makeDirty() { dirty = true; };
+    /// @note this marks the entire frame as changed
+    void makeDirty();
+
+    /// transform a rectangle from content into frame coordinates
+    /// @param aRect area in content coordinates
+    /// @return area in frame coordinates (which are the parent view's content coordinates)
+    PixelRect contentToFrameRect(PixelRect aRect);
+
+    /// mark part of the content as changed
+    /// @param aRect the changed area in content coordinates
+    void makeContentDirty(PixelRect aRect);
+
+    /// mark part of the frame as changed, and report it to the parent view
+    /// @param aRect the changed area in frame coordinates (which are the parent view's content coordinates)
+    void makeFrameRectDirty(PixelRect aRect);
+
+    /// called by subviews to report changes
+    /// @param aChild the subview that has changed
+    /// @param aRect the changed area in this view's content coordinates
+    virtual void childDirty(View *aChild, PixelRect aRect);
+
+    /// report a change of frame, content transformation/size or view structure to the parent views
+    /// @note this is what invalidates precomputed render lists of parent view stacks
+    void makeGeometryDirty() { if (parentView) parentView->childGeometryChanged(); };
+
+    /// called by subviews (directly or indirectly) when their geometry has changed
+    virtual void childGeometryChanged() { makeGeometryDirty(); };
+
+    /// request a call to step() as soon as possible, e.g. because a time based change was started
+    /// @note this is reported to the need update handler of the root view
+    void requestStep();
+
+    /// helper for snapshot() implementations: copy frame, content geometry, alpha, fading and dirty state
+    /// @param aView the view to copy the state from
+    /// @note the parent view and callbacks are not copied, a snapshot is not connected to anything
+    void copyViewState(const View &aView);
 
   public :
 
@@ -128,8 +241,8 @@ namespace p44 {
     virtual void setFrame(int aOriginX, int aOriginY, int aSizeX, int aSizeY);
 
     /// set the view's background color
-    /// @param aBackGroundColor color of pixels not covered by content
-    void setBackGroundColor(PixelColor aBackGroundColor) { backgroundColor = aBackGroundColor; makeDirty(); };
+    /// @param aBackGroundColor color of pixels not covered by content (straight, not premultiplied alpha)
+    void setBackGroundColor(PixelColor aBackGroundColor) { backgroundColor = premultipliedPixel(aBackGroundColor); makeDirty(); makeGeometryDirty(); };
 
     /// set view's alpha
     /// @param aAlpha 0=fully transparent, 255=fully opaque
@@ -160,13 +273,13 @@ namespace p44 {
     void stopFading();
 
     /// @param aOrientation the orientation of the content
-    void setOrientation(Orientation aOrientation) { contentOrientation = aOrientation; makeDirty(); }
+    void setOrientation(Orientation aOrientation) { contentOrientation = aOrientation; makeDirty(); makeGeometryDirty(); }
 
     /// set content offset
-    void setContentOffset(int aOffsetX, int aOffsetY) { offsetX = aOffsetX; offsetY = aOffsetY; makeDirty(); };
+    void setContentOffset(int aOffsetX, int aOffsetY) { offsetX = aOffsetX; offsetY = aOffsetY; makeDirty(); makeGeometryDirty(); };
 
     /// set content size
-    void setContentSize(int aSizeX, int aSizeY) { contentSizeX = aSizeX; contentSizeY = aSizeY; makeDirty(); };
+    void setContentSize(int aSizeX, int aSizeY) { contentSizeX = aSizeX; contentSizeY = aSizeY; makeDirty(); makeGeometryDirty(); };
 
     /// set content size to full frame content with same coordinates
     void setFullFrameContent();
@@ -176,19 +289,65 @@ namespace p44 {
     /// @note this is called on the active page at least once per mainloop cycle
     virtual bool step();
 
+    /// get time when step() needs to be called next
+    /// @return time of next time based change, Infinite if no time based changes are pending
+    /// @note changes not driven by step() (e.g. by timers or API requests) report via the need update handler instead
+    virtual MLMicroSeconds nextStepTime();
+
+    /// set handler to be called when this view is a root view and needs to be stepped or redisplayed
+    /// @param aNeedUpdateCB handler, called whenever the view becomes dirty or requests a step
+    void setNeedUpdateHandler(SimpleCB aNeedUpdateCB) { needUpdateCB = aNeedUpdateCB; };
+
     /// return if anything changed on the display since last call
-    virtual bool isDirty() { return dirty; };
+    bool isDirty() { return !rectEmpty(dirtyRect); };
+
+    /// return if view is currently animating, i.e. expected to change by itself in the next steps
+    virtual bool isAnimating() { return targetAlpha>=0; };
+
+    /// get the area where all pixels of this view are known to be fully opaque
+    /// @return opaque area in frame coordinates, zeroRect if no opaque area is known
+    /// @note views stacked below can be skipped entirely within this area
+    virtual PixelRect getOpaqueRect() { return zeroRect; };
+
+    /// create a frozen copy of this view (and its subviews) for rendering
+    /// @return the copy. It renders the same pixels and reports the same dirty and animating state as this view
+    ///   does now, and can be rendered from another thread while this view continues to change.
+    /// @note snapshots must be created and released on the main loop, only rendering them is thread safe.
+    ///   Subclasses must override this to copy the state their rendering depends on.
+    virtual ViewPtr snapshot();
+
+    /// get the area changed since last call to updated()
+    /// @return changed area in frame coordinates (for a page's main view, these are PlayField coordinates)
+    PixelRect getDirtyRect() { return dirtyRect; };
 
     /// call when display is updated
-    virtual void updated() { dirty = false; };
+    virtual void updated() { if (isDirty()) updateCount++; dirtyRect = zeroRect; };
+
+    /// get the frame
+    /// @return the frame of this view
+    PixelRect getFrame() { PixelRect r = { .x=originX, .y=originY, .dx=dX, .dy=dY }; return r; };
+
+    /// check if a pixel is within the frame
+    /// @param aX PlayField X coordinate
+    /// @param aY PlayField Y coordinate
+    /// @return true if aX,aY is within the frame. Views are invisible outside their frame.
+    bool isInFrame(int aX, int aY) { return aX>=originX && aX<originX+dX && aY>=originY && aY<originY+dY; };
 
     /// get color at X,Y
     /// @param aX PlayField X coordinate
     /// @param aY PlayField Y coordinate
     virtual PixelColor colorAt(int aX, int aY);
 
+    /// render a horizontal span of pixels
+    /// @param aY PlayField Y coordinate of the span
+    /// @param aX0 PlayField X coordinate of the first pixel of the span
+    /// @param aX1 PlayField X coordinate following the last pixel of the span
+    /// @param aOut buffer to receive aX1-aX0 pixels
+    /// @note produces the same colors as calling colorAt() for every pixel, but with only one
+    ///   coordinate transformation and virtual call per span.
+    virtual void renderSpan(int aY, int aX0, int aX1, PixelColor *aOut);
+
   };
-  typedef boost::intrusive_ptr<View> ViewPtr;
 
 } // namespace p44
 
@@ -29,6 +29,7 @@ using namespace p44;
 ViewAnimator::ViewAnimator() :
   repeating(false),
   currentStep(-1),
+  snapshotRunning(false),
   animationState(as_begin)
 {
 }
@@ -36,13 +37,20 @@ ViewAnimator::ViewAnimator() :
 
 ViewAnimator::~ViewAnimator()
 {
+  for (SequenceVector::iterator pos = sequence.begin(); pos!=sequence.end(); ++pos) {
+    pos->view->parentView = NULL;
+  }
 }
 
 
 void ViewAnimator::clear()
 {
   stopAnimation();
+  for (SequenceVector::iterator pos = sequence.begin(); pos!=sequence.end(); ++pos) {
+    pos->view->parentView = NULL;
+  }
   sequence.clear();
+  currentView = NULL;
   inherited::clear();
 }
 
@@ -55,6 +63,7 @@ void ViewAnimator::pushStep(ViewPtr aView, MLMicroSeconds aShowTime, MLMicroSeco
   s.fadeInTime = aFadeInTime;
   s.fadeOutTime = aFadeOutTime;
   sequence.push_back(s);
+  aView->parentView = this;
   makeDirty();
 }
 
@@ -70,6 +79,25 @@ bool ViewAnimator::step()
 }
 
 
+MLMicroSeconds ViewAnimator::nextStepTime()
+{
+  MLMicroSeconds next = inherited::nextStepTime();
+  if (currentStep<sequence.size()) {
+    const AnimationStep &as = sequence[currentStep];
+    MLMicroSeconds t = as.view->nextStepTime();
+    if (t<next) next = t;
+    // next state change
+    switch (animationState) {
+      case as_begin: t = BoardClock::now(); break;
+      case as_show: t = lastStateChange+as.fadeInTime+as.showTime+1; break;
+      case as_fadeout: t = lastStateChange+as.fadeOutTime; break;
+    }
+    if (t<next) next = t;
+  }
+  return next;
+}
+
+
 void ViewAnimator::stopAnimation()
 {
   if (currentView) currentView->stopFading();
@@ -78,17 +106,39 @@ void ViewAnimator::stopAnimation()
 }
 
 
+bool ViewAnimator::isAnimating()
+{
+  return inherited::isAnimating() || snapshotRunning || (currentStep>=0 && currentStep<sequence.size());
+}
+
+
+ViewPtr ViewAnimator::snapshot()
+{
+  ViewAnimatorPtr s = ViewAnimatorPtr(new ViewAnimator);
+  s->copyViewState(*this);
+  if (currentView) {
+    s->currentView = currentView->snapshot();
+    s->currentView->parentView = s.get();
+  }
+  s->snapshotRunning = currentStep>=0 && currentStep<sequence.size();
+  return s;
+}
+
+
 void ViewAnimator::stepAnimation()
 {
   if (currentStep<sequence.size()) {
-    MLMicroSeconds now = MainLoop::now();
+    MLMicroSeconds now = BoardClock::now();
     MLMicroSeconds sinceLast = now-lastStateChange;
     AnimationStep as = sequence[currentStep];
     switch (animationState) {
       case as_begin:
         // initiate animation
         // - set current view
-        currentView = as.view;
+        if (currentView!=as.view) {
+          currentView = as.view;
+          makeDirty();
+        }
         if (as.fadeInTime>0) {
           currentView->setAlpha(0);
           currentView->fadeTo(255, as.fadeInTime);
@@ -146,14 +196,16 @@ void ViewAnimator::startAnimation(bool aRepeat, SimpleCB aCompletedCB)
   currentStep = 0;
   animationState = as_begin; // begins from start
   stepAnimation();
+  requestStep();
 }
 
 
 
-bool ViewAnimator::isDirty()
+void ViewAnimator::childDirty(View *aChild, PixelRect aRect)
 {
-  if (inherited::isDirty()) return true; // dirty anyway
-  return currentView ? currentView->isDirty() : false; // dirty if currently active view is dirty
+  if (aChild==currentView.get()) {
+    inherited::childDirty(aChild, aRect);
+  }
 }
 
 
@@ -175,3 +227,24 @@ PixelColor ViewAnimator::contentColorAt(int aX, int aY)
     return currentView->colorAt(aX, aY);
   }
 }
+
+
+void ViewAnimator::contentSpan(int aX, int aY, int aDx, int aDy, int aNum, PixelColor *aOut)
+{
+  if (alpha==0 || !currentView) {
+    for (int i=0; i<aNum; i++) aOut[i] = transparent; // entire animator is invisible
+  }
+  else if (aDy==0 && aDx==1) {
+    // row in content coordinates: let current step's view render it
+    currentView->renderSpan(aY, aX, aX+aNum, aOut);
+  }
+  else if (aDy==0 && aDx==-1) {
+    // reversed row
+    currentView->renderSpan(aY, aX-aNum+1, aX+1, aOut);
+    std::reverse(aOut, aOut+aNum);
+  }
+  else {
+    // rotated, must evaluate per pixel
+    inherited::contentSpan(aX, aY, aDx, aDy, aNum, aOut);
+  }
+}
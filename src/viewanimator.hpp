@@ -49,6 +49,7 @@ namespace p44 {
     int currentStep; ///< current step in running animation
     SimpleCB completedCB; ///< called when one animation run is done
     ViewPtr currentView; ///< current view
+    bool snapshotRunning; ///< only in snapshots (which have no sequence): set if the animation was running
 
     enum {
       as_begin,
@@ -86,14 +87,24 @@ namespace p44 {
     /// @note this is called on the active page at least once per mainloop cycle
     virtual bool step();
 
-    /// return if anything changed on the display since last call
-    virtual bool isDirty();
+    /// get time when step() needs to be called next
+    /// @return earliest of the next animation state change and the current step view's next step time
+    virtual MLMicroSeconds nextStepTime();
 
     /// call when display is updated
     void updated();
 
+    /// return if view is currently animating
+    virtual bool isAnimating();
+
+    /// create a frozen copy of this view, showing a copy of the current step's view
+    virtual ViewPtr snapshot();
+
   protected:
 
+    /// only changes of the currently shown step's view are relevant
+    virtual void childDirty(View *aChild, PixelRect aRect);
+
     /// get content pixel color
     /// @param aX content X coordinate
     /// @param aY content Y coordinate
@@ -101,6 +112,9 @@ namespace p44 {
     ///   implementation must check this!
     virtual PixelColor contentColorAt(int aX, int aY);
 
+    /// get a run of content pixel colors from the current step's view
+    virtual void contentSpan(int aX, int aY, int aDx, int aDy, int aNum, PixelColor *aOut);
+
   private:
 
     void stepAnimation();
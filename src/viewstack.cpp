@@ -21,24 +21,51 @@
 
 #include "viewstack.hpp"
 
+#include <climits>
+
 using namespace p44;
 
 
 // MARK: ===== ViewStack
 
-ViewStack::ViewStack()
+ViewStack::ViewStack() :
+  renderListValid(false),
+  geometryGeneration(0)
 {
+  cache = StaticLayerCachePtr(new StaticLayerCache);
 }
 
 
 ViewStack::~ViewStack()
 {
+  for (ViewsList::iterator pos = viewStack.begin(); pos!=viewStack.end(); ++pos) {
+    (*pos)->parentView = NULL;
+  }
+}
+
+
+ViewPtr ViewStack::snapshot()
+{
+  ViewStackPtr s = ViewStackPtr(new ViewStack);
+  s->copyViewState(*this);
+  for (ViewsList::iterator pos = viewStack.begin(); pos!=viewStack.end(); ++pos) {
+    ViewPtr v = (*pos)->snapshot();
+    v->parentView = s.get();
+    s->viewStack.push_back(v);
+  }
+  s->cache = cache;
+  s->geometryGeneration = geometryGeneration;
+  return s;
 }
 
 
 void ViewStack::clear()
 {
+  for (ViewsList::iterator pos = viewStack.begin(); pos!=viewStack.end(); ++pos) {
+    (*pos)->parentView = NULL;
+  }
   viewStack.clear();
+  childGeometryChanged();
   inherited::clear();
 }
 
@@ -46,14 +73,20 @@ void ViewStack::clear()
 void ViewStack::pushView(ViewPtr aView)
 {
   viewStack.push_back(aView);
-  makeDirty();
+  aView->parentView = this;
+  childGeometryChanged();
+  makeContentDirty(aView->getFrame());
 }
 
 
 void ViewStack::popView()
 {
+  if (viewStack.empty()) return;
+  ViewPtr v = viewStack.back();
   viewStack.pop_back();
-  makeDirty();
+  v->parentView = NULL;
+  childGeometryChanged();
+  makeContentDirty(v->getFrame());
 }
 
 
@@ -62,6 +95,9 @@ void ViewStack::removeView(ViewPtr aView)
   for (ViewsList::iterator pos = viewStack.begin(); pos!=viewStack.end(); ++pos) {
     if ((*pos)==aView) {
       viewStack.erase(pos);
+      aView->parentView = NULL;
+      childGeometryChanged();
+      makeContentDirty(aView->getFrame());
       break;
     }
   }
@@ -80,14 +116,14 @@ bool ViewStack::step()
 }
 
 
-bool ViewStack::isDirty()
+MLMicroSeconds ViewStack::nextStepTime()
 {
-  if (inherited::isDirty()) return true; // dirty anyway
+  MLMicroSeconds next = inherited::nextStepTime();
   for (ViewsList::iterator pos = viewStack.begin(); pos!=viewStack.end(); ++pos) {
-    if ((*pos)->isDirty())
-      return true; // subview is dirty -> stack is dirty
+    MLMicroSeconds t = (*pos)->nextStepTime();
+    if (t<next) next = t;
   }
-  return false;
+  return next;
 }
 
 
@@ -100,6 +136,205 @@ void ViewStack::updated()
 }
 
 
+bool ViewStack::isAnimating()
+{
+  if (inherited::isAnimating()) return true;
+  for (ViewsList::iterator pos = viewStack.begin(); pos!=viewStack.end(); ++pos) {
+    if ((*pos)->isAnimating()) return true;
+  }
+  return false;
+}
+
+
+void ViewStack::childGeometryChanged()
+{
+  renderListValid = false;
+  geometryGeneration++; // cache (possibly in use by a snapshot) is invalid now
+  inherited::childGeometryChanged();
+}
+
+
+// MARK: ===== flattened render list
+
+void ViewStack::buildRenderList()
+{
+  renderList.clear();
+  // clip of direct subviews is only their own frame
+  PixelRect all = { .x=INT_MIN/4, .y=INT_MIN/4, .dx=INT_MAX/2, .dy=INT_MAX/2 };
+  for (ViewsList::reverse_iterator pos = viewStack.rbegin(); pos!=viewStack.rend(); ++pos) {
+    addToRenderList(pos->get(), identityTransform, all);
+  }
+  renderListValid = true;
+}
+
+
+void ViewStack::addToRenderList(View *aView, const PixelTransform &aParentTransform, PixelRect aClip)
+{
+  RenderEntry e;
+  e.parentTransform = aParentTransform;
+  e.transform = transformConcat(aParentTransform, aView->contentTransform());
+  e.clip = transformRectInverse(aParentTransform, aView->getFrame());
+  rectIntersect(e.clip, aClip);
+  if (rectEmpty(e.clip)) return; // not visible at all
+  ViewStack *sub = dynamic_cast<ViewStack *>(aView);
+  if (sub && sub->alpha==255) {
+    // fully opaque sub-stack: render its subviews directly, followed by its background
+    for (ViewsList::reverse_iterator pos = sub->viewStack.rbegin(); pos!=sub->viewStack.rend(); ++pos) {
+      addToRenderList(pos->get(), e.transform, e.clip);
+    }
+    e.view = NULL;
+    e.fill = sub->backgroundColor;
+    e.fill.a = 255; // composited stacks are opaque
+  }
+  else {
+    // leaf view, or semi-transparent stack which must be composited on its own before applying alpha
+    e.view = aView;
+  }
+  renderList.push_back(e);
+}
+
+
+void ViewStack::compositeSpan(int aY, int aX0, PixelColor *aAccu, size_t aFirst, size_t aEnd, int &aLo, int &aHi)
+{
+  for (size_t i=aFirst; i<aEnd && aLo<aHi; i++) {
+    const RenderEntry &e = renderList[i];
+    if (e.view && e.view->alpha==0) continue; // shortcut: skip fully transparent layers
+    // clip
+    if (aY<e.clip.y || aY>=e.clip.y+e.clip.dy) continue;
+    int lo = max(e.clip.x-aX0, aLo);
+    int hi = min(e.clip.x+e.clip.dx-aX0, aHi);
+    if (lo>=hi) continue;
+    PixelRect o;
+    if (e.view) {
+      // render view's content directly, with composed transformation
+      int x = aX0+lo;
+      const PixelTransform &t = e.transform;
+      e.view->contentSpan(t.xx*x+t.xy*aY+t.x0, t.yx*x+t.yy*aY+t.y0, t.xx, t.yx, hi-lo, &layerSpan[lo]);
+      e.view->finishSpan(&layerSpan[lo], hi-lo);
+      o = transformRectInverse(e.parentTransform, e.view->getOpaqueRect());
+      rectIntersect(o, e.clip);
+    }
+    else {
+      // background of a flattened stack
+      for (int j=lo; j<hi; j++) layerSpan[j] = e.fill;
+      o = e.clip;
+    }
+    blendSpanUnder(aAccu+lo, &layerSpan[lo], hi-lo);
+    // entries below are invisible where this one is opaque
+    if (aY>=o.y && aY<o.y+o.dy) {
+      int olo = max(o.x-aX0, aLo);
+      int ohi = min(o.x+o.dx-aX0, aHi);
+      if (olo<ohi) {
+        if (olo==aLo) aLo = ohi; // covers beginning of span
+        else if (ohi==aHi) aHi = olo; // covers end of span
+      }
+    }
+  }
+}
+
+
+// MARK: ===== static layer cache
+
+size_t ViewStack::staticEntryRun()
+{
+  // changed but otherwise static views are cacheable, only their dirty area needs updating
+  size_t n = 0;
+  for (RenderList::reverse_iterator pos = renderList.rbegin(); pos!=renderList.rend(); ++pos) {
+    if (pos->view && pos->view->isAnimating()) break;
+    n++;
+  }
+  return n;
+}
+
+
+bool ViewStack::validateCache()
+{
+  if (cache->generation!=geometryGeneration || contentSizeX!=cache->sizeX || contentSizeY!=cache->sizeY) {
+    invalidateCache();
+  }
+  size_t run = staticEntryRun();
+  if (run<cache->entries) {
+    // a cached entry has started animating, cache must shrink
+    invalidateCache();
+  }
+  // collect the changes of cached entries not yet in the cache
+  PixelRect changed = zeroRect;
+  for (size_t i=renderList.size()-cache->entries; i<renderList.size(); i++) {
+    View *v = renderList[i].view;
+    if (!v) continue; // background fill only changes with geometry
+    StaticLayerCache::EntryState &es = cache->entryStates[i];
+    if (v->updateCount==es.updateCount+1 && es.includesDirty) {
+      // the dirty area already in the cache has been displayed
+      es.updateCount = v->updateCount;
+      es.includesDirty = false;
+    }
+    if (v->updateCount!=es.updateCount) {
+      // changes were displayed without the cache seeing them
+      invalidateCache();
+      break;
+    }
+    if (v->isDirty() && !es.includesDirty) {
+      PixelRect r = transformRectInverse(renderList[i].parentTransform, v->getDirtyRect());
+      rectIntersect(r, renderList[i].clip);
+      rectUnion(changed, r);
+      es.includesDirty = true;
+    }
+  }
+  if (run>cache->entries) {
+    // (re)build cache with more entries
+    cache->sizeX = contentSizeX;
+    cache->sizeY = contentSizeY;
+    cache->generation = geometryGeneration;
+    cache->pixels.resize(cache->sizeX*cache->sizeY);
+    cache->entryStates.resize(renderList.size());
+    cache->entries = run;
+    for (size_t i=renderList.size()-run; i<renderList.size(); i++) {
+      View *v = renderList[i].view;
+      if (!v) continue;
+      cache->entryStates[i].updateCount = v->updateCount;
+      cache->entryStates[i].includesDirty = v->isDirty();
+    }
+    PixelRect all = { .x=0, .y=0, .dx=cache->sizeX, .dy=cache->sizeY };
+    renderCacheRect(all);
+  }
+  else if (cache->entries>0 && !rectEmpty(changed)) {
+    // only update the changed area
+    PixelRect all = { .x=0, .y=0, .dx=cache->sizeX, .dy=cache->sizeY };
+    rectIntersect(changed, all);
+    if (!rectEmpty(changed)) renderCacheRect(changed);
+  }
+  return cache->entries>0;
+}
+
+
+void ViewStack::renderCacheRect(PixelRect aRect)
+{
+  if ((int)layerSpan.size()<aRect.dx) {
+    layerSpan.resize(aRect.dx);
+  }
+  size_t first = renderList.size()-cache->entries;
+  for (int y=aRect.y; y<aRect.y+aRect.dy; y++) {
+    PixelColor *row = &cache->pixels[y*cache->sizeX+aRect.x];
+    for (int x=0; x<aRect.dx; x++) {
+      row[x] = black; // alpha holds the seethrough left
+    }
+    int lo = 0;
+    int hi = aRect.dx;
+    compositeSpan(y, aRect.x, row, first, renderList.size(), lo, hi);
+    if (lo<hi) {
+      for (int x=lo; x<hi; x++) {
+        layerSpan[x] = backgroundColor;
+      }
+      blendSpanUnder(row+lo, &layerSpan[lo], hi-lo);
+    }
+    // cached pixel acts as a single premultiplied layer: alpha is what is covered
+    for (int x=0; x<aRect.dx; x++) {
+      row[x].a = 255-row[x].a;
+    }
+  }
+}
+
+
 PixelColor ViewStack::contentColorAt(int aX, int aY)
 {
   // default is the viewstack's background color
@@ -107,33 +342,77 @@ PixelColor ViewStack::contentColorAt(int aX, int aY)
     return transparent; // entire viewstack is invisible
   }
   else {
-    // consult views in stack
-    PixelColor pc = black;
-    PixelColor lc;
-    uint8_t seethrough = 255; // first layer is directly visible, not yet obscured
-    for (ViewsList::reverse_iterator pos = viewStack.rbegin(); pos!=viewStack.rend(); ++pos) {
-      ViewPtr layer = *pos;
-      if (layer->alpha==0) continue; // shortcut: skip fully transparent layers
-      lc = layer->colorAt(aX, aY);
-      if (lc.a==0) continue; // skip layer with fully transparent pixel
-      // not-fully-transparent pixel
-      // - scale down to current budget left
-      lc.a = dimVal(lc.a, seethrough);
-      lc = dimPixel(lc, lc.a);
-      addToPixel(pc, lc);
-      seethrough -= lc.a;
-      if (seethrough<=0) break; // nothing more to see though
-    } // collect from all layers
-    if (seethrough>0) {
+    if (!renderListValid) buildRenderList();
+    if (layerSpan.size()<1) layerSpan.resize(1);
+    // consult all views
+    PixelColor pc = black; // alpha holds the seethrough left, first layer is directly visible, not yet obscured
+    int lo = 0;
+    int hi = 1;
+    compositeSpan(aY, aX, &pc, 0, renderList.size(), lo, hi);
+    if (lo<hi && pc.a>0) {
       // rest is background
-      lc.a = dimVal(backgroundColor.a, seethrough);
-      lc = dimPixel(backgroundColor, lc.a);
-      addToPixel(pc, lc);
+      blendSpanUnderScalar(&pc, &backgroundColor, 1);
     }
-    // factor in alpha of entire viewstack
+    // result is opaque, factor in alpha of entire viewstack
+    pc.a = 255;
     if (alpha!=255) {
-      pc.a = dimVal(pc.a, alpha);
+      pc = dimPremultipliedPixel(pc, alpha);
     }
     return pc;
   }
 }
+
+
+void ViewStack::contentSpan(int aX, int aY, int aDx, int aDy, int aNum, PixelColor *aOut)
+{
+  if (aDy!=0 || (aDx!=1 && aDx!=-1)) {
+    // not a row in content coordinates (rotated stack), layers can only be evaluated per pixel
+    inherited::contentSpan(aX, aY, aDx, aDy, aNum, aOut);
+    return;
+  }
+  if (alpha==0) {
+    for (int i=0; i<aNum; i++) aOut[i] = transparent; // entire viewstack is invisible
+    return;
+  }
+  if (!renderListValid) buildRenderList();
+  // layers render left to right, reverse at end if span runs backwards in content coordinates
+  int x0 = aDx>0 ? aX : aX-aNum+1;
+  if ((int)layerSpan.size()<aNum) {
+    layerSpan.resize(aNum);
+  }
+  // static bottom entries can be taken from cache if span is entirely within content
+  bool useCache = aY>=0 && aY<contentSizeY && x0>=0 && x0+aNum<=contentSizeX && validateCache();
+  size_t liveEntries = renderList.size()-(useCache ? cache->entries : 0);
+  // while compositing, alpha of output pixels holds the seethrough left
+  for (int i=0; i<aNum; i++) {
+    aOut[i] = black; // first layer is directly visible, not yet obscured
+  }
+  // composite all live entries
+  // - lo..hi is the part of the span not yet covered by opaque entries
+  int lo = 0;
+  int hi = aNum;
+  compositeSpan(aY, x0, aOut, 0, liveEntries, lo, hi);
+  if (lo<hi) {
+    if (useCache) {
+      // rest is static entries and background
+      blendSpanUnder(aOut+lo, &cache->pixels[aY*cache->sizeX+x0+lo], hi-lo);
+    }
+    else {
+      // rest is background
+      for (int i=lo; i<hi; i++) {
+        layerSpan[i] = backgroundColor;
+      }
+      blendSpanUnder(aOut+lo, &layerSpan[lo], hi-lo);
+    }
+  }
+  // result is opaque, factor in alpha of entire viewstack
+  for (int i=0; i<aNum; i++) {
+    aOut[i].a = 255;
+    if (alpha!=255) {
+      aOut[i] = dimPremultipliedPixel(aOut[i], alpha);
+    }
+  }
+  if (aDx<0) {
+    std::reverse(aOut, aOut+aNum);
+  }
+}
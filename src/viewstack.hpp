@@ -26,6 +26,33 @@
 
 namespace p44 {
 
+  /// composite of the bottom static layers of a view stack, shared between the stack and its snapshots
+  /// so the composite survives from one snapshot to the next
+  /// @note only one of the views sharing the cache may be rendered at a time
+  class StaticLayerCache : public P44Obj
+  {
+    friend class ViewStack;
+
+    /// what the cache knows about one cached render list entry's view
+    typedef struct {
+      long updateCount; ///< the view's updateCount the cached pixels are based on
+      bool includesDirty; ///< set if the view's dirty area at updateCount is already contained in the cached pixels
+    } EntryState;
+
+    std::vector<PixelColor> pixels; ///< premultiplied composite of the bottom static render list entries over the background, in content coordinates
+    size_t entries; ///< number of bottom render list entries contained in pixels, 0 if cache is invalid
+    std::vector<EntryState> entryStates; ///< state of the cached views, indexed like the render list
+    int sizeX; ///< content X size the cache was built for
+    int sizeY; ///< content Y size the cache was built for
+    long generation; ///< geometry generation of the stack the cache was built for
+
+  public:
+
+    StaticLayerCache() : entries(0), sizeX(0), sizeY(0), generation(0) {};
+  };
+  typedef boost::intrusive_ptr<StaticLayerCache> StaticLayerCachePtr;
+
+
   class ViewStack : public View
   {
     typedef View inherited;
@@ -34,6 +61,25 @@ namespace p44 {
 
     ViewsList viewStack;
 
+    // flattened render list
+    typedef struct {
+      View *view; ///< the view to render, NULL for the background fill of a flattened sub-stack
+      PixelTransform transform; ///< from content coordinates of this stack into the view's content coordinates
+      PixelTransform parentTransform; ///< from content coordinates of this stack into the view's frame coordinates
+      PixelRect clip; ///< visible area (in content coordinates of this stack)
+      PixelColor fill; ///< background fill color (premultiplied, alpha 255 because nothing below is visible)
+    } RenderEntry;
+    typedef std::vector<RenderEntry> RenderList;
+    RenderList renderList; ///< all views to render, front to back
+    bool renderListValid; ///< set when renderList matches current view tree structure and geometry
+
+    // span rendering buffers
+    std::vector<PixelColor> layerSpan; ///< span rendered by one layer
+
+    // static layer cache
+    StaticLayerCachePtr cache; ///< the static layer cache, shared with snapshots of this stack
+    long geometryGeneration; ///< incremented whenever the render list changes, to invalidate the cache
+
   public :
 
     /// create view stack
@@ -61,14 +107,28 @@ namespace p44 {
     /// @note this is called on the active page at least once per mainloop cycle
     virtual bool step();
 
-    /// return if anything changed on the display since last call
-    virtual bool isDirty();
+    /// get time when step() needs to be called next
+    /// @return earliest next step time of the stack itself and all views in the stack
+    virtual MLMicroSeconds nextStepTime();
 
     /// call when display is updated
     void updated();
 
+    /// return if any of the views in the stack is animating
+    virtual bool isAnimating();
+
+    /// create a frozen copy of the stack and all of its subviews
+    /// @note the copy shares the static layer cache with this stack
+    virtual ViewPtr snapshot() P44_OVERRIDE;
+
+    /// the composited stack has no transparent pixels
+    virtual PixelRect getOpaqueRect() { return alpha==255 ? getFrame() : zeroRect; };
+
   protected:
 
+    /// invalidates the render list when geometry or structure of any of the subviews changes
+    virtual void childGeometryChanged();
+
     /// get content pixel color
     /// @param aX content X coordinate
     /// @param aY content Y coordinate
@@ -76,6 +136,45 @@ namespace p44 {
     ///   implementation must check this!
     virtual PixelColor contentColorAt(int aX, int aY);
 
+    /// get a run of content pixel colors, rendering entire spans from all layers
+    virtual void contentSpan(int aX, int aY, int aDx, int aDy, int aNum, PixelColor *aOut);
+
+  private:
+
+    /// flatten the view tree into renderList
+    void buildRenderList();
+
+    /// add a view (and all of its subviews if it is a fully opaque stack) to the render list
+    /// @param aView the view to add
+    /// @param aParentTransform transformation from content coordinates of this stack to the view's frame coordinates
+    /// @param aClip visible area so far (in content coordinates of this stack)
+    void addToRenderList(View *aView, const PixelTransform &aParentTransform, PixelRect aClip);
+
+    /// composite a part of the render list into a row of accumulated pixels
+    /// @param aY the row (in content coordinates)
+    /// @param aX0 the column of the first pixel in aAccu (in content coordinates)
+    /// @param aAccu accumulated pixels (alpha holding seethrough left)
+    /// @param aFirst first render list entry to composite
+    /// @param aEnd render list entry after the last one to composite
+    /// @param aLo on input: first pixel in aAccu to composite, on output: first pixel not yet covered by opaque entries
+    /// @param aHi on input: end of pixels in aAccu to composite, on output: end of pixels not yet covered by opaque entries
+    void compositeSpan(int aY, int aX0, PixelColor *aAccu, size_t aFirst, size_t aEnd, int &aLo, int &aHi);
+
+    /// number of consecutive bottom render list entries that are not animating
+    size_t staticEntryRun();
+
+    /// make sure the static layer cache covers as many static bottom render list entries as possible
+    /// @return true if cache is valid and can be used
+    /// @note cached entries that have changed only get their dirty area updated in the cache
+    bool validateCache();
+
+    /// composite the cached entries and the background into an area of the cache
+    /// @param aRect the area to render (in content coordinates)
+    void renderCacheRect(PixelRect aRect);
+
+    /// invalidate the static layer cache
+    void invalidateCache() { cache->entries = 0; };
+
   };
   typedef boost::intrusive_ptr<ViewStack> ViewStackPtr;
 